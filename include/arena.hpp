@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// bump pointer allocator for everything that lives as long as the
+// compilation, nothing is freed on its own. rewind frees everything made
+// after a mark and release frees it all
+class Arena
+{
+	static const std::size_t BLOCK = 1 << 16;
+
+	std::vector<char *> blocks;
+	char *cur, *end;
+
+	// start a new block with room for size bytes
+	void grow(std::size_t size);
+
+public:
+	struct Mark
+	{
+		std::size_t blocks;
+		char *cur, *end;
+	};
+
+	Arena() : cur(nullptr), end(nullptr) {}
+	~Arena() { release(); }
+
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+
+	void *alloc(std::size_t size, std::size_t align)
+	{
+		std::uintptr_t p = (reinterpret_cast<std::uintptr_t>(cur) + align - 1) & ~(align - 1);
+
+		if (!cur || p + size > reinterpret_cast<std::uintptr_t>(end))
+		{
+			grow(size + align);
+			p = (reinterpret_cast<std::uintptr_t>(cur) + align - 1) & ~(align - 1);
+		}
+
+		cur = reinterpret_cast<char *>(p + size);
+		return reinterpret_cast<void *>(p);
+	}
+
+	Mark mark() const { return { blocks.size(), cur, end }; }
+	void rewind(const Mark &m);
+	void release();
+};
+
+// asts and scopes of the current compilation
+extern Arena arena;
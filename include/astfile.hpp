@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+#include <parser.hpp>
+
+// a parsed translation unit written out so that it can be compiled
+// again without lexing or parsing it. the node arrays, list kids, scopes
+// and symbols are stored the way the ast store and scope table hold
+// them, all located by offsets, so loading is a few copies out of the
+// mapped file and the list kids are used in place
+
+// write the tree under root along with every scope and symbol to filename
+void save_ast(const std::string &filename, AST root);
+// load a tree saved by save_ast into the empty ast store and scope table,
+// returns its root
+AST load_ast(const std::string &filename);
@@ -1,8 +1,12 @@
 #pragma once
 
-enum NodeType {
+#include <cstdint>
+
+// stored as bytes in the ast
+enum NodeType : std::uint8_t {
 	NONE,
 	WIDEN,
+	TRUNC,
 	LIST,
 	IF,
 	FOR,
@@ -70,13 +74,17 @@ enum NodeType {
 	NODE_COUNT
 };
 
-enum PrimType {
+// base types, everything else is built on them in the type table
+enum PrimType : std::uint8_t {
 	NO_WIDEN,
 	VOID, INT, CHAR, LONG,
-	VOID_PTR, INT_PTR, CHAR_PTR, LONG_PTR,
 	P_COUNT
 };
 
+// handle to an interned type (see types.hpp), the handle of a base type
+// is its PrimType
+using Type = std::uint32_t;
+
 extern const char *PRIM_NAMES[P_COUNT];
 extern const char *NODE_NAMES[NODE_COUNT];
 
@@ -4,6 +4,9 @@
 
 #include <lexer.hpp>
 
-void err_tok(const std::string &msg, Token t);
+class Preproc;
+
+void err_tok(const std::string &msg, const Preproc &pp, const Token &t);
+void err_at(const std::string &msg, const SrcPos &pos);
 void err(const std::string &msg);
 void warning(const std::string &msg);
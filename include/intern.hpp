@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// every distinct identifier gets a dense id when it is lexed, so symbol
+// tables compare ints and each name is only stored once
+using Name = std::uint32_t;
+
+Name intern(std::string_view s);
+std::string_view name_str(Name n);
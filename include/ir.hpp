@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <codegen.hpp>
+
+// three address code of one function, lowered from its tree in
+// codegen.cpp and turned into assembly by the instruction selector in
+// x86gen.cpp. values live in virtual registers, as many as needed.
+// variables stay in memory and are only touched by loads and stores, so
+// a virtual register only ever holds a temporary of one statement
+
+using VReg = int;
+const VReg NOVREG = -1;
+
+enum IROp : std::uint8_t {
+	// dst = imm
+	IR_IMM,
+	// dst = a
+	IR_MOV,
+	// dst = a sign extended from size from
+	IR_WIDEN,
+	// dst = sym, sign extended if it is narrower than size
+	IR_LOAD,
+	// sym = a, or imm if a is NOVREG
+	IR_STORE,
+
+	// dst = a op b, imm takes the place of b if it is NOVREG
+	IR_ADD,
+	IR_SUB,
+	IR_MUL,
+	IR_DIV,
+	IR_MOD,
+	IR_AND,
+	IR_OR,
+	IR_XOR,
+	IR_SHL,
+	IR_SHR,
+	// dst = a cc b, 1 or 0
+	IR_SETCC,
+
+	// dst = op a
+	IR_NEG,
+	IR_NOT,
+
+	// dst = sym(args), the args are count from first in IRFunc::args
+	IR_CALL,
+
+	// terminators, the last instruction of every block
+	// goto t
+	IR_JMP,
+	// if (a cc b) goto t else goto f
+	IR_BR,
+	// return a, or imm if a is NOVREG
+	IR_RET,
+};
+
+struct Inst
+{
+	IROp op;
+	// width the operation is done at, and for IR_WIDEN the old width
+	Size size, from;
+	// condition of IR_SETCC and IR_BR
+	Idx cc;
+	VReg dst, a, b;
+	std::int64_t imm;
+	// variable of loads and stores, function of calls
+	const Sym *sym;
+	// blocks of jumps and branches, or the first arg and arg count of calls
+	int t, f;
+};
+
+struct Block
+{
+	std::vector<Inst> insts;
+	// filled in by IRFunc::finish
+	std::vector<int> succs, preds;
+	int lbl;
+
+	bool done() const { return !insts.empty() && insts.back().op >= IR_JMP; }
+};
+
+// first and last instruction a virtual register is live at, counted
+// along the block order
+struct Interval
+{
+	VReg v;
+	int start, end;
+};
+
+struct IRFunc
+{
+	const Sym *sym;
+	// bytes of locals below rbp
+	int frame;
+	// how many params came in registers
+	int params;
+
+	std::vector<Block> blocks;
+	// reachable blocks in the order they are emitted, entry first
+	std::vector<int> order;
+	std::vector<VReg> args;
+	int vregs;
+	// block instructions are added to
+	int cur;
+
+	IRFunc(const Sym &sym, int frame, int params)
+		: sym(&sym), frame(frame), params(params), vregs(0), cur(-1) {}
+
+	VReg vreg() { return vregs++; }
+	// new block, not in the order until it is started
+	int block();
+	// continue in b, jumping there if the current block falls through
+	void start(int b);
+	// jump to b unless the current block already ended
+	void jump(int b);
+	Inst &emit(IROp op, Size size, VReg dst = NOVREG, VReg a = NOVREG, VReg b = NOVREG);
+
+	// build the cfg, thread jumps, drop unreachable blocks and dead
+	// instructions
+	void finish();
+	// where a jump to each block ends up
+	std::vector<int> targets() const;
+	// one interval per virtual register that is used, by start
+	std::vector<Interval> intervals() const;
+};
+
+// lower a function with a body to ir
+IRFunc lower_func(AST n);
+// instruction selection, register allocation and output of a function
+void select_func(const IRFunc &f);
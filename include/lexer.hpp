@@ -1,9 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
-#include <variant>
 #include <string>
-#include <deque>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include <intern.hpp>
 
 // easier to type - multi char tokens
 #define TOKS                      \
@@ -85,57 +91,187 @@ enum TokType
 	FP_CONSTANT,
 	CHAR_CONSTANT,
 	STR_CONSTANT,
+
+	// a '#' starting a line, and the end of that line
+	PP_HASH,
+	PP_EOL,
+	// stands in for a false #if group in a header's token cache
+	PP_SKIP,
 	TOK_COUNT,
 };
 
+// 16 bytes and trivially copyable, the text of a token is a span of the
+// source buffer (see Lexer::text)
 struct Token
 {
-	TokType type;
-
-	int line, col, char_count;
+	TokType type : 8;
+	std::uint32_t len : 24;
+	std::uint32_t offset;
 
-	// union of potential token values
-	std::variant<long long, double, std::string> val;
+	// value of int, char and fp constants, id of identifiers
+	union
+	{
+		long long ival;
+		double fval;
+		Name name;
+	};
 
-	Token(TokType type, int line, int col, int char_count)
+	Token() = default;
+	Token(TokType type, std::size_t offset, std::size_t len)
 		: type(type)
-		, line(line)
-		, col(col)
-		, char_count(char_count) {}
-
-	Token(const Token &t)
-		: type(t.type)
-		, line(t.line)
-		, col(t.col)
-		, char_count(t.char_count)
-		, val(t.val) {}
+		, len(len)
+		, offset(offset)
+		, ival(0) {}
+};
+
+// longest token text Token::len can hold
+const std::size_t MAX_TOKEN_LEN = (1 << 24) - 1;
+
+static_assert(sizeof(Token) == 16, "Token should fit in 16 bytes");
+static_assert(std::is_trivially_copyable<Token>::value, "Token should be trivially copyable");
+
+// only computed when an error message needs it
+struct SrcPos
+{
+	std::size_t line, col;
+	// empty for the main file
+	std::string_view file;
 };
 
 class Lexer
 {
-	int index, line, col;
-	char *buf;
-	std::deque<Token> tok_buf;
+	// index into buf, buf_pos is the source offset of buf[0]
+	std::size_t index, buf_pos;
+	// chars up to visible can be lexed, buf[visible] is always '\0'
+	std::size_t visible;
+	const char *buf;
+
+	// files are mmapped whole, map_len is the mapped size
+	std::size_t map_len;
+
+	// pipes are read in CHUNK sized pieces into window, which holds
+	// the current token and the unlexed input.
+	// buf[visible] is swapped with held when visible < filled
+	static const std::size_t CHUNK = 1 << 16;
+	int fd;
+	bool eof;
+	std::vector<char> window;
+	std::size_t filled;
+	char held;
+	// last char dropped from the window that isn't a space or tab,
+	// for first_on_line
+	char dropped;
+
+	// inside a directive, newlines end it with a PP_EOL
+	bool directive;
+	// shown in error messages, empty for the main file
+	std::string name;
+
+	// start of every line, built when a position is needed or before
+	// streamed bytes are dropped. streamed input only keeps the lines
+	// positions can still be asked for, see trim_lines
+	struct LineStart
+	{
+		std::size_t start, line;
+	};
+	mutable std::size_t lines_scanned;
+	mutable std::vector<LineStart> lines;
+	// positions before released aren't asked for, except on pinned lines.
+	// lexed_to is the offset of the last token
+	std::size_t released, lexed_to;
+	std::vector<LineStart> pinned;
+
+	// big mapped files are split at newlines and lexed on a thread pool,
+	// each chunk assuming it starts outside of a comment or string.
+	// stitch then checks every chunk against where the previous one
+	// really ended, and relexes the front of it until the two line up
+	static const std::size_t PARALLEL_MIN = 1 << 20;
+
+	struct Chunk
+	{
+		std::size_t start, end;
+		// tokens starting in [start, end), lexed from start
+		std::vector<Token> toks;
+		// where the next chunk should pick up, or where the error was
+		std::size_t stop;
+		bool failed;
+		// directive state at stop
+		bool directive;
+
+		// output is fixed, then toks[from:], then the error if there is one
+		std::vector<Token> fixed;
+		std::size_t fixed_i, from;
+		bool error;
+	};
+
+	// true for pool threads: errors throw, and names are interned in order
+	// when the token is handed to the parser
+	bool worker;
+	std::vector<Chunk> chunks;
+	std::size_t cur_chunk;
+	Token last;
+
+	// lexes part of a mapped file on a pool thread
+	Lexer(const Lexer &whole, std::size_t start);
+
+	void prelex();
+	void lex_chunk(Chunk &c) const;
+	void stitch();
+	// next pre-lexed token
+	Token fetch();
 
 	// generate next token
-	Token next();
-	// move index forward by count
-	int count(int count);
-	// check if keyword exists at index
-	bool keyword(const char *keyword);
+	Token lex();
 	// check if blockcomment is unterminated
 	void blockcomment();
+	// move index past text up to a '#' starting a line, or the end
+	void skip_text();
+	// read more of a streamed input, false if there is no more
+	bool refill();
+	// add line starts up to visible
+	void scan_lines() const;
+	// drop the lines of a streamed input that have no tokens left on them
+	void trim_lines();
+	// the line offset is on, which has to be in lines
+	std::size_t line_of(std::size_t offset) const;
+	// only spaces between the start of the line and buf[i]
+	bool first_on_line(std::size_t i) const;
 
 public:
 	void lex_err(const std::string &msg);
 
-	Lexer(const std::string &filename);
+	Lexer(const std::string &filename, bool header = false);
 	~Lexer();
 
-	// remove token from stream, error if unexpected
-	Token eat(TokType expected);
-	// peek at next tokens without removing, default is next token
-	Token peek(unsigned lookahead = 1);
+	// next token, directives are left to the preprocessor
+	Token next()
+	{
+		if (!chunks.empty())
+			return fetch();
+
+		Token t = lex();
+		lexed_to = t.offset;
+		return t;
+	}
+	// skip the rest of a false #if group, up to the '#' of the next
+	// directive. it isn't lexed, so anything but comments goes
+	void skip_group();
+	// source offset of the next unlexed char
+	std::size_t offset() const { return buf_pos + index; }
+	// lex a mapped file again from offset, outside of any directive
+	void seek(std::size_t offset);
+	// only mapped files can seek
+	bool seekable() const { return fd < 0; }
+
+	// source text of a token
+	// for streamed input, only valid until the next token is lexed
+	std::string_view text(const Token &t) const { return std::string_view(buf + (t.offset - buf_pos), t.len); }
+	// line and col of a source offset
+	SrcPos pos(std::size_t offset) const;
+	// positions before offset won't be asked for again, unless pinned
+	void release(std::size_t offset) { released = std::max(released, offset); }
+	// keep the position of the line of offset after it's released
+	void pin(std::size_t offset);
 
 	static const char *getname(TokType t);
 };
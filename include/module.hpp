@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+// a declaration module is the global scope of one compilation, written
+// out so that others can start from it instead of parsing the same
+// prototypes again. the file is a header, fixed size symbol records and
+// then the names, all located by offsets so it can be used in place
+
+// write every symbol in the global scope to filename
+void save_module(const std::string &filename);
+// add the symbols of a module to the global scope
+void load_module(const std::string &filename);
@@ -1,169 +1,220 @@
 #pragma once
 
+#include <cstdint>
 #include <fstream>
 #include <vector>
 
-#include <lexer.hpp>
+#include <preproc.hpp>
 #include <scope.hpp>
 #include <defs.hpp>
 
+struct ASTList;
+
+// handle to a node in the ast store, id 0 is no node
 struct AST {
-	NodeType type;
+	std::uint32_t id;
+
+	AST() : id(0) {}
+	explicit AST(std::uint32_t id) : id(id) {}
+
+	explicit operator bool() const { return id; }
+	bool operator==(AST o) const { return id == o.id; }
+	bool operator!=(AST o) const { return id != o.id; }
+
+	// references into the store, only good until the next node is made.
+	// n.lhs() = make(...) is fine, the right side is evaluated first
+	NodeType &type() const;
 	// every node has a primitive type
-	PrimType ptype;
-	AST *lhs, *mid, *rhs;
+	Type &ptype() const;
+	AST &lhs() const;
+	AST &mid() const;
+	AST &rhs() const;
 
-	// used for byte count of vars for scope ast
-	// used for symbol id for variable ast
-	int val;
-	int scope_id;
+	// used for symbol id for variable ast, in the table of its scope
+	// used for the index into the store's lists for list ast
+	int &val() const;
+	int &scope_id() const;
 
-	Sym &get_sym() const { return Scope::s(scope_id)->syms[val]; }
+	Sym &get_sym() const { return Scope::sym(scope_id(), val()); }
 
-	// appends to an "ast list"
-	// ordering: top down, left to right
-	static AST *append(AST *bottom, AST *node, NodeType t)
-	{
-		// if lhs available
-		if (!bottom->lhs)
-		{
-			bottom->lhs = node;
-			return bottom;
-		}
-		// if mid available
-		else if (!bottom->mid)
-		{
-			bottom->mid = node;
-			return bottom;
-		}
-		// none are avaiable, add ast to bottom of tree
-		else
-		{
-			AST *new_bottom = new AST(t, INT, node);
-			bottom->rhs = new_bottom;
-			return new_bottom;
-		}
-	}
+	// kids of a list node
+	ASTList kids() const;
+
+	// list nodes are built by pushing their kids on a scratch stack, lists
+	// nested in them push and pop above. make_list moves the kids from
+	// start on into the arena
+	static std::size_t list_start();
+	static void list_add(AST kid);
+	static AST make_list(std::size_t start);
 
 	// generic constructors
-	AST(NodeType type, PrimType p, AST *lhs, AST *mid, AST *rhs)
-		: type(type), ptype(p), lhs(lhs), mid(mid), rhs(rhs), val(0) {}
+	static AST make(NodeType type, Type p, AST lhs, AST mid, AST rhs);
 
-	AST(NodeType type, PrimType p, AST *lhs, AST *rhs)
-		: AST(type, p, lhs, nullptr, rhs) {}
+	static AST make(NodeType type, Type p, AST lhs, AST rhs)
+		{ return make(type, p, lhs, AST(), rhs); }
 
-	AST(NodeType type, PrimType p, AST *lhs)
-		: AST(type, p, lhs, nullptr, nullptr) {}
+	static AST make(NodeType type, Type p, AST lhs)
+		{ return make(type, p, lhs, AST(), AST()); }
 
-	AST(NodeType type)
-		: AST(type, INT, nullptr, nullptr, nullptr) {}
+	static AST make(NodeType type)
+		{ return make(type, INT, AST(), AST(), AST()); }
 
 	// val leaf
-	AST(NodeType type, PrimType p, int val)
-		: type(type), ptype(p), lhs(nullptr), mid(nullptr), rhs(nullptr), val(val) {}
+	static AST make(NodeType type, Type p, int val)
+	{
+		AST out = make(type, p, AST(), AST(), AST());
+		out.val() = val;
+		return out;
+	}
 
 	// var
-	AST(PrimType p, int entry, int scope_id)
-		: type(VAR), ptype(p), lhs(nullptr), mid(nullptr), rhs(nullptr), val(entry), scope_id(scope_id) {}
-
-	// to be safe
-	AST()
-		: lhs(nullptr), mid(nullptr), rhs(nullptr), val(0) {}
+	static AST make_var(Type p, int entry, int scope_id)
+	{
+		AST out = make(VAR, p, entry);
+		out.scope_id() = scope_id;
+		return out;
+	}
 };
 
-// iterator for ease of use, goes through list asts
-class ASTIter {
-	const AST *cur;
-	int n;
+// contiguous kids of a list node, the array lives in the arena
+struct ASTList {
+	const AST *data;
+	std::uint32_t count;
 
-public:
-	ASTIter(const AST *list)
-		: cur(list), n(0) {}
-	
-	bool has_next()
-	{
-		if (cur)
-		{
-			switch (n) {
-				case 0: return cur->lhs;
-				case 1: return cur->mid;
-				case 2: return cur->rhs && cur->rhs->lhs;
-				default: return false;
-			}
-		}
-		else
-			return false;
-	}
-	
-	AST *next()
+	std::uint32_t size() const { return count; }
+	AST operator[](std::uint32_t i) const { return data[i]; }
+	const AST *begin() const { return data; }
+	const AST *end() const { return data + count; }
+};
+
+// every node is an index into these, so a node takes 22 bytes and whole
+// tree walks read a few dense arrays instead of chasing pointers
+struct ASTStore {
+	std::vector<NodeType> type;
+	std::vector<Type> ptype;
+	std::vector<AST> lhs, mid, rhs;
+	std::vector<int> val, scope_id;
+
+	// spans of list nodes, and the kids of the lists being parsed
+	std::vector<ASTList> lists;
+	std::vector<AST> scratch;
+
+	// holds the empty node at id 0
+	ASTStore()
+		: type(1, NONE), ptype(1, NO_WIDEN), lhs(1), mid(1), rhs(1), val(1), scope_id(1) {}
+
+	// rewind drops every node and list made after a mark, the arena
+	// keeps their kids until it's rewound as well
+	struct Mark
 	{
-		switch (n++) {
-			case 0: return cur->lhs;
-			case 1: return cur->mid;
-			case 2:
-				cur = cur->rhs;
-				n = 0;
-				return next();
-			default: return nullptr;
-		}
-	}
+		std::size_t nodes, lists;
+	};
+
+	Mark mark() const { return { type.size(), lists.size() }; }
+	void rewind(const Mark &m);
 };
 
+extern ASTStore asts;
+
+inline NodeType &AST::type() const { return asts.type[id]; }
+inline Type &AST::ptype() const { return asts.ptype[id]; }
+inline AST &AST::lhs() const { return asts.lhs[id]; }
+inline AST &AST::mid() const { return asts.mid[id]; }
+inline AST &AST::rhs() const { return asts.rhs[id]; }
+inline int &AST::val() const { return asts.val[id]; }
+inline int &AST::scope_id() const { return asts.scope_id[id]; }
+
+inline ASTList AST::kids() const { return asts.lists[val()]; }
+inline std::size_t AST::list_start() { return asts.scratch.size(); }
+inline void AST::list_add(AST kid) { asts.scratch.push_back(kid); }
+
 // -------- parser class -------- //
 
 class Parser
 {
-	Lexer &l;
+	Preproc &l;
 
 	// context
 	int cur_scope; // used to set scope of new asts
 	int offset;
 	int stk_size;
-	bool in_loop;
-
-	AST *expr();
-	AST *exp_option();
-	AST *stmt();
-
-	AST *func();
-	AST *decl();
-	AST *if_stmt();
-	AST *for_stmt();
-	AST *while_stmt();
-	AST *do_stmt();
-
-	AST *compound(bool newscope=true);
-
-	AST *lval();
-	AST *assign();
-
-	AST *cond();
-	AST *op_or();
-	AST *op_and();
-	AST *bitwise_or();
-	AST *bitwise_xor();
-	AST *bitwise_and();
-	AST *equality();
-	AST *comparison();
-	AST *shift();
-	AST *term();
-	AST *factor();
-	AST *unop();
-	AST *postfix();
-	AST *primary();
-	AST *call();
+	// loops the statement being parsed is in
+	int loops;
+
+	AST expr();
+	AST exp_option();
+	AST stmt();
+
+	AST func();
+	AST decl();
+
+	// a statement with statements in it, that is still waiting for them.
+	// they are parsed off this stack so nesting is only limited by memory
+	struct PendingStmt
+	{
+		enum Kind { BLOCK, IF, FOR, WHILE, DO } kind;
+		AST out;
+		// the if of a ladder that gets the next statement, or the FOR
+		// under out
+		AST cur;
+		// where the kids of a block start on the list scratch
+		std::size_t start;
+		// a block or for with its own scope, or an if waiting for its else
+		bool flag;
+	};
+
+	std::vector<PendingStmt> stmts;
+
+	// these open a statement on stmts
+	void if_stmt();
+	void for_stmt();
+	void while_stmt();
+	void do_stmt();
+	void block(bool newscope);
+
+	void if_cond(AST n);
+	AST open_stmt();
+	AST close_stmt(AST kid);
+	AST close_stmts(std::size_t base, AST out);
+
+	AST compound(bool newscope);
+
+	AST lval();
+	AST var(const Token &id);
+
+	// an operator or bracket of the expression being parsed that is
+	// still waiting for operands, see expr
+	struct PendingOp
+	{
+		enum Kind { BINARY, PREFIX, ASSIGN, PAREN, CALL, QUESTION, COLON } kind;
+		NodeType node;
+		int prec;
+		// where the args of a call start on the list scratch
+		std::size_t args;
+	};
+
+	std::vector<PendingOp> ops;
+	std::vector<AST> vals;
+
+	void reduce();
+	void postfix();
+	void open_call();
+	void close_call();
 
 public:
-	Parser(Lexer &l)
+	Parser(Preproc &l)
 		: l(l)
 		// create global scope
 		, cur_scope(Scope::new_scope(0))
 		, offset(0)
 		, stk_size(0)
-		, in_loop(false) {}
+		, loops(0) {}
 
-	AST *parse();
+	// next func or decl, no node at the end of the file
+	AST parse_next();
+	// the whole file as a list
+	AST parse();
 
 	static NodeType asnode(TokType t);
-	static PrimType asptype(TokType t);
+	static Type asptype(TokType t);
 };
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <lexer.hpp>
+
+// sits between the lexer and the parser: follows #includes, expands
+// object-like macros and drops the tokens in false #if branches.
+// every file gets its own range of token offsets, see pos
+class Preproc
+{
+	struct File
+	{
+		std::string path;
+		std::unique_ptr<Lexer> lex;
+
+		// headers keep their raw tokens, directives included, so that
+		// including them again doesn't lex them again. a false #if group
+		// is a PP_SKIP with its local offset in ival
+		bool cache;
+		std::vector<Token> toks;
+		// toks is complete
+		bool done;
+
+		// #pragma once
+		bool once;
+		// macro from an #ifndef around the whole file, 0 if there isn't one
+		Name guard;
+	};
+
+	// where raw tokens come from, either the lexer of a file or its cache
+	struct Input
+	{
+		File *file;
+		bool replay;
+		std::size_t at;
+		// added to lexer offsets
+		std::size_t delta;
+		// size of conds when the file was entered
+		std::size_t conds;
+		// replaying, but lexing a group the cache skipped
+		bool lexing;
+	};
+
+	// offsets from start on are in file, starting at its offset local
+	struct Segment
+	{
+		std::size_t start, local;
+		const File *file;
+	};
+
+	struct Cond
+	{
+		// keeping tokens, a branch was already kept, past the #else
+		bool active, taken, seen_else;
+	};
+
+	// an identifier being replaced by its macro
+	struct Frame
+	{
+		Name macro;
+		const std::vector<Token> *toks;
+		std::size_t at;
+	};
+
+	static const std::size_t MAX_DEPTH = 200;
+
+	std::vector<std::unique_ptr<File>> files;
+	std::unordered_map<std::string, File *> by_path;
+	std::vector<std::string> include_dirs;
+
+	std::vector<Input> inputs;
+	std::vector<Segment> segments;
+	// first offset that doesn't belong to a file yet
+	std::size_t high;
+
+	std::unordered_map<Name, std::vector<Token>> macros;
+	std::vector<Cond> conds;
+	std::vector<Frame> frames;
+
+	// directive names
+	Name n_define, n_undef, n_include, n_ifdef, n_ifndef, n_elif, n_endif;
+	Name n_pragma, n_once, n_defined;
+
+	// ring buffer of lookahead tokens, the parser peeks at most 3 ahead
+	static const unsigned LOOKAHEAD = 4;
+	Token tok_buf[LOOKAHEAD];
+	unsigned head, buffered;
+
+	File *open(const std::string &path, bool cache);
+	// start reading a file, from the start of its cache if replay
+	void enter(File *f, bool replay);
+	// give the lexer of the top input a new segment from high
+	void resume();
+	Name find_guard(const File &f) const;
+	const Segment &segment(std::size_t offset) const;
+
+	// next raw token, moves on to the includer at the end of a header
+	Token raw();
+	// next token for the parser
+	Token next();
+
+	void directive();
+	void define();
+	void include();
+	// rest of the line as an #if expression
+	bool eval_line();
+	// line with macros and defined replaced
+	void expand_into(const std::vector<Token> &line, std::vector<Token> &out, std::vector<Name> &blocked);
+	void end_line();
+	void skip_line();
+	// pass over a false #if group
+	void skip_group();
+
+	bool active() const { return conds.empty() || conds.back().active; }
+	bool is(const Token &t, Name n) const { return t.type == IDENTIFIER && t.name == n; }
+
+public:
+	Preproc(const std::string &filename, const std::vector<std::string> &include_dirs = {});
+
+	// remove token from stream, error if unexpected
+	Token eat(TokType expected);
+	// peek at next tokens without removing, default is next token
+	// the reference is good until the token is eaten
+	const Token &peek(unsigned lookahead = 1);
+
+	// source text of a token
+	std::string_view text(const Token &t) const;
+	// line, col and file of an offset
+	SrcPos pos(std::size_t offset) const;
+	// positions before the next token won't be asked for again
+	void release();
+
+	static const char *getname(TokType t) { return Lexer::getname(t); }
+};
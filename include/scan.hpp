@@ -0,0 +1,24 @@
+#pragma once
+
+// byte scanners used by the lexer. every scanner stops at '\0', which
+// the lexer guarantees is mapped after the last char of the source.
+// vector versions are picked at runtime, with a scalar fallback
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_SIMD
+#endif
+
+// these don't go through the locale like <cctype>
+constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool is_alpha(char c) { return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; }
+constexpr bool is_alnum(char c) { return is_alpha(c) || is_digit(c); }
+constexpr bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f'; }
+
+// return a pointer to the first char that isn't part of the run
+const char *skip_space(const char *p);
+const char *skip_ident(const char *p);
+const char *skip_digits(const char *p);
+
+// return a pointer to the first a (or b), or to the '\0'
+const char *find_char(const char *p, char a);
+const char *find_char2(const char *p, char a, char b);
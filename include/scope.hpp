@@ -2,28 +2,38 @@
 
 #include <lexer.hpp>
 #include <defs.hpp>
+#include <arena.hpp>
 
+#include <unordered_map>
 #include <vector>
 
+#include <intern.hpp>
+
 enum VarType { V_GLOBL, V_VAR, V_REG, V_FUNC };
 
+// most params a function can take, the least C allows
+const int MAX_PARAMS = 127;
+
 struct Sym {
 	VarType vtype;
-	PrimType type;
-	std::string name;
+	Type type;
+	Name name;
 	// param count for V_FUNC
 	// if assigned or not for V_GLOBL
 	// offset if V_VAR
 	int val;
+	// where the param types of a V_FUNC start, see Scope::param
+	std::uint32_t params;
 
-	Sym(VarType vtype, PrimType type, const std::string &name)
-		: vtype(vtype), type(type), name(name), val(0) {}
-	Sym(VarType vtype, PrimType type, const std::string &name, int val)
-		: vtype(vtype), type(type), name(name), val(val) {}
+	Sym(VarType vtype, Type type, Name name)
+		: vtype(vtype), type(type), name(name), val(0), params(0) {}
+	Sym(VarType vtype, Type type, Name name, int val)
+		: vtype(vtype), type(type), name(name), val(val), params(0) {}
 };
 
-struct AST;
-
+// symbols of the global scope and of every other scope are kept in two
+// flat tables, so a symbol is the table of its scope plus an id. the
+// locals are dropped with their scopes, the globals never are
 struct Scope {
 	int parent_id;
 	int id;
@@ -31,20 +41,56 @@ struct Scope {
 	// total bytes of all vars
 	int size;
 
-	std::vector<Sym> syms;
+	// ids of this scope's symbols, in declaration order
+	std::vector<int> syms;
+	// first symbol with each name
+	std::unordered_map<Name, int> index;
 
-	// entry, id
-	AST *get(const std::string &name);
-	bool in_scope(const std::string &name);
+	// adds a symbol to this scope, returns its id
+	int add(const Sym &s);
+	// id of the first symbol named name in this scope, -1 if there isn't one
+	int find_local(Name name) const
+	{
+		auto it = index.find(name);
+		return it == index.end() ? -1 : it->second;
+	}
+	// scope of the innermost symbol named name, going out to the global
+	// scope. -1 if there is none, otherwise id is set to the symbol
+	int find(Name name, int &id) const;
+	bool in_scope(Name name) const { return index.count(name); }
 
+	// freed with the arena, along with the asts
+	static void *operator new(std::size_t size) { return arena.alloc(size, alignof(Scope)); }
+	static void operator delete(void *) {}
 
 	// static functions
 	static int new_scope(int cur);
 	static Scope *s(int id) { return scopes[id]; };
+	static Sym &sym(int scope, int id) { return scope == GLOBAL ? globals[id] : locals[id]; }
+
+	struct Mark
+	{
+		int scopes;
+		std::size_t locals;
+	};
+
+	// param types of every function, in one table like the globals.
+	// add_params returns where the types start
+	static std::uint32_t add_params(const Type *types, int count);
+	static Type param(const Sym &fn, int i) { return param_types[fn.params + i]; }
+	static const std::vector<Type> &all_params() { return param_types; }
+
+	static int count() { return scope_count; }
+	// rewind deletes the scopes and locals made after a mark
+	static Mark mark() { return { scope_count, locals.size() }; }
+	static void rewind(const Mark &m);
 
 	static const int GLOBAL = 0;
 
 private:
 	static std::vector<Scope*> scopes;
 	static int scope_count;
+
+	static std::vector<Sym> globals, locals;
+	static std::vector<Type> param_types;
 };
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <parser.hpp>
+
+// runs between parsing and codegen. gives every node under root its
+// final type, wraps operands that have to be converted in WIDEN or TRUNC
+// nodes and reports type errors, so codegen only reads the tree
+void check_types(AST root);
@@ -0,0 +1,99 @@
+#pragma once
+
+/**
+ * Generic vector scanners, instantiated once per instruction set in
+ * scan_sse2.cpp and scan_avx2.cpp. V is a trait with:
+ *   T, W (bytes per block), FULL (mask with W bits set),
+ *   load(p) (aligned), eq(v, c), in(v, lo, hi), lower(v), or_(a, b),
+ *   mask(v) (one bit per byte)
+ */
+
+#include <cstdint>
+
+namespace {
+
+// loads are aligned, so a block never crosses into an unmapped page and
+// reading up to and a little past the '\0' is safe
+template <class V, class Stop>
+inline const char *scan(const char *p, Stop stop)
+{
+	std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(p);
+	const char *blk = reinterpret_cast<const char *>(addr & ~std::uintptr_t(V::W - 1));
+
+	std::uint32_t m = stop(V::load(blk)) >> (addr & (V::W - 1));
+	if (m)
+		return p + __builtin_ctz(m);
+
+	for (;;)
+	{
+		blk += V::W;
+		m = stop(V::load(blk));
+		if (m)
+			return blk + __builtin_ctz(m);
+	}
+}
+
+template <class V>
+const char *k_skip_space(const char *p)
+{
+	return scan<V>(p, [](typename V::T v) {
+		// '\t', '\n', '\v' and '\f' are all in 9 to 12
+		return V::mask(V::or_(V::eq(v, ' '), V::in(v, '\t', '\f'))) ^ V::FULL;
+	});
+}
+
+template <class V>
+const char *k_skip_ident(const char *p)
+{
+	return scan<V>(p, [](typename V::T v) {
+		return V::mask(V::or_(V::or_(V::in(V::lower(v), 'a', 'z'), V::in(v, '0', '9')),
+		                      V::eq(v, '_'))) ^ V::FULL;
+	});
+}
+
+template <class V>
+const char *k_skip_digits(const char *p)
+{
+	return scan<V>(p, [](typename V::T v) {
+		return V::mask(V::in(v, '0', '9')) ^ V::FULL;
+	});
+}
+
+template <class V>
+const char *k_find_char(const char *p, char a)
+{
+	return scan<V>(p, [a](typename V::T v) {
+		return V::mask(V::or_(V::eq(v, a), V::eq(v, '\0')));
+	});
+}
+
+template <class V>
+const char *k_find_char2(const char *p, char a, char b)
+{
+	return scan<V>(p, [a, b](typename V::T v) {
+		return V::mask(V::or_(V::or_(V::eq(v, a), V::eq(v, b)), V::eq(v, '\0')));
+	});
+}
+
+}
+
+#define SCAN_DECLS(isa)                                      \
+	namespace isa {                                          \
+		const char *skip_space(const char *p);               \
+		const char *skip_ident(const char *p);               \
+		const char *skip_digits(const char *p);              \
+		const char *find_char(const char *p, char a);        \
+		const char *find_char2(const char *p, char a, char b); \
+	}
+
+#define SCAN_DEFS(isa, V)                                                                           \
+	namespace isa {                                                                                 \
+		const char *skip_space(const char *p) { return k_skip_space<V>(p); }                        \
+		const char *skip_ident(const char *p) { return k_skip_ident<V>(p); }                        \
+		const char *skip_digits(const char *p) { return k_skip_digits<V>(p); }                      \
+		const char *find_char(const char *p, char a) { return k_find_char<V>(p, a); }               \
+		const char *find_char2(const char *p, char a, char b) { return k_find_char2<V>(p, a, b); }  \
+	}
+
+SCAN_DECLS(sse2)
+SCAN_DECLS(avx2)
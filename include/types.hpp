@@ -1,20 +1,85 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include <codegen.hpp>
 #include <defs.hpp>
 
 struct AST;
 
-/**
- * For me to understand:
- * Method is given two ast nodes which are interacting in some
- * way, and their primtype is replaced with NO_WIDEN if no widening
- * is neccessary. If widening is neccessary, the node is replaced with
- * a WIDEN node with its type set to the type to widen to
- */
-bool compat_types(AST *parent, bool assigning);
-bool compat_types(PrimType out, AST **in);
-Size p_sizeof(PrimType t);
+enum TypeKind : std::uint8_t { T_BASE, T_PTR, T_ARRAY };
+
+// qualifier bits
+const std::uint8_t Q_CONST = 1;
+
+// one entry of the type table. a type is made once and then only
+// referred to by its handle, so equal types have equal handles
+struct TypeInfo
+{
+	TypeKind kind;
+	// base type at the bottom of the pointers and arrays
+	PrimType base;
+	std::uint8_t quals;
+	// number of pointers between this and the base
+	std::uint8_t depth;
+	// pointee or element type
+	Type of;
+	// element count of arrays
+	std::uint32_t len;
+
+	// precomputed when the type is made
+	std::uint32_t bytes, align;
+	// register width of a value
+	Size size;
+	// the same type without qualifiers
+	Type unqual;
+	// without qualifiers at any level, pointers to types with equal
+	// plain handles mix
+	Type plain;
+};
+
+// largest object or stack frame, so byte sizes and rbp offsets always
+// fit in an int
+const std::uint32_t MAX_OBJECT_BYTES = 1u << 30;
+
+// get or make a type
+Type pointer_to(Type t);
+// check array_fits first
+Type array_of(Type t, std::uint32_t len);
+// false if len elements of t would be larger than MAX_OBJECT_BYTES
+bool array_fits(Type t, std::uint64_t len);
+Type qualified(Type t, std::uint8_t quals);
+// make a type from the fields that identify it, of has to exist already
+Type make_type(TypeKind kind, PrimType base, std::uint8_t quals, Type of, std::uint32_t len);
+
+const TypeInfo &type_info(Type t);
+// number of types in the table, handles are below it
+std::uint32_t type_count();
+// "char **", "const int [4]"
+std::string type_name(Type t);
+
+// a type as stored in module and ast files, of is the index of an earlier
+// record. the plain base types are not stored, records start at P_COUNT
+struct TypeRec
+{
+	std::uint8_t kind, base, quals, pad;
+	std::uint32_t of, len;
+};
 
-PrimType pointer_type(PrimType t);
+// every type made so far
+std::vector<TypeRec> save_types();
+// make the types of recs, map gets the handle of every record index.
+// false if the records are malformed
+bool load_types(const TypeRec *recs, std::uint32_t count, std::vector<Type> &map);
 
+// the narrower operand of parent is put in a WIDEN node of the type of
+// the other one
+void compat_types(AST parent);
+// returns in, or a WIDEN or TRUNC node around it. pointers to different
+// types are an error, and mixing pointers with integers is warned about
+AST compat_types(Type out, AST in);
+Size p_sizeof(Type t);
+// width a value is kept at in a register, narrower values are sign
+// extended to int
+Size reg_size(Type t);
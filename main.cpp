@@ -1,45 +1,168 @@
 #include <iostream>
 
+#include <astfile.hpp>
 #include <codegen.hpp>
+#include <module.hpp>
 #include <scope.hpp>
+#include <sema.hpp>
 #include <types.hpp>
 #include <err.hpp>
 
-void prettyprint(const AST *ast, int tabs)
+// walks the tree off an explicit stack, kids are pushed last first
+void prettyprint(AST root, int tabs)
 {
-	if (!ast)
-		return;
-
-	for (int i = 0; i < tabs; ++i)
-		printf("  ");
-
-	if (ast->val)
-		printf("%s %d ptype: %d\n", NODE_NAMES[ast->type], ast->val, ast->ptype);
-	else if (ast->type == VAR)
-		printf("%s %s ptype: %d\n", NODE_NAMES[ast->type], ast->get_sym().name.c_str(), ast->ptype);
-	else
-		printf("%s\n", NODE_NAMES[ast->type]);
-
-	prettyprint(ast->lhs, tabs + 1);
-	prettyprint(ast->mid, tabs + 1);
-	prettyprint(ast->rhs, tabs + 1);
+	std::vector<std::pair<AST, int>> stack = { { root, tabs } };
+
+	while (!stack.empty())
+	{
+		AST ast = stack.back().first;
+		int tabs = stack.back().second;
+		stack.pop_back();
+
+		if (!ast)
+			continue;
+
+		for (int i = 0; i < tabs; ++i)
+			printf("  ");
+
+		if (ast.val() && ast.type() != LIST)
+			printf("%s %d ptype: %d\n", NODE_NAMES[ast.type()], ast.val(), ast.ptype());
+		else if (ast.type() == VAR)
+		{
+			std::string_view name = name_str(ast.get_sym().name);
+			printf("%s %.*s ptype: %d\n", NODE_NAMES[ast.type()], static_cast<int>(name.size()), name.data(), ast.ptype());
+		}
+		else
+			printf("%s\n", NODE_NAMES[ast.type()]);
+
+		if (ast.type() == LIST)
+		{
+			ASTList kids = ast.kids();
+			for (std::uint32_t i = kids.size(); i-- > 0;)
+				stack.push_back({ kids[i], tabs + 1 });
+		}
+		else
+		{
+			stack.push_back({ ast.rhs(), tabs + 1 });
+			stack.push_back({ ast.mid(), tabs + 1 });
+			stack.push_back({ ast.lhs(), tabs + 1 });
+		}
+	}
+}
+
+// -q turns the tree dump off, it's quadratic in the depth of the tree
+static bool print_tree = true;
+
+// generates a whole tree at once, for trees that are saved or loaded
+static void compile(AST ast, const std::string &emit_module)
+{
+	if (!emit_module.empty())
+		save_module(emit_module);
+
+	check_types(ast);
+	if (print_tree)
+		prettyprint(ast, 0);
+
+	init_cg("out.s");
+	gen_item(ast);
+	gen_globls();
 }
 
 int main(int argc, const char *argv[]) {
-	if (argc == 1)
+	std::vector<std::string> include_dirs;
+	std::vector<std::string> modules;
+	std::string emit_module;
+	std::string emit_ast, ast_file;
+	const char *file = nullptr;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg(argv[i]);
+
+		if (arg.rfind("-I", 0) == 0 && arg.size() > 2)
+			include_dirs.push_back(arg.substr(2));
+		else if (arg.rfind("--module=", 0) == 0)
+			modules.push_back(arg.substr(9));
+		else if (arg.rfind("--emit-module=", 0) == 0)
+			emit_module = arg.substr(14);
+		else if (arg.rfind("--emit-ast=", 0) == 0)
+			emit_ast = arg.substr(11);
+		else if (arg.rfind("--ast=", 0) == 0)
+			ast_file = arg.substr(6);
+		else if (arg == "-q")
+			print_tree = false;
+		else
+			file = argv[i];
+	}
+
+	// a saved tree replaces the source, and has the modules it was parsed with
+	if (!ast_file.empty())
+	{
+		if (!modules.empty())
+		{
+			std::cerr << "Modules can't be loaded along with an AST file!\n";
+			return 1;
+		}
+
+		compile(load_ast(ast_file), emit_module);
+		return 0;
+	}
+
+	if (!file)
 	{
 		std::cerr << "Must specify input file!\n";
 		return 1;
 	}
 
-	Lexer l(argv[1]);
+	Preproc pp(file, include_dirs);
+
+	Parser p(pp);
 
-	Parser p(l);
-	AST *ast = p.parse();
+	// declarations from other compilations go in the global scope first
+	for (const std::string &m : modules)
+		load_module(m);
 
-	prettyprint(ast, 0);
+	// writing the tree out needs all of it
+	if (!emit_ast.empty())
+	{
+		AST ast = p.parse();
+		save_ast(emit_ast, ast);
+		compile(ast, emit_module);
+		return 0;
+	}
 
 	init_cg("out.s");
-	gen_ast(ast, Ctx(NOREG, NONE, 0, 0, 0));
+
+	// functions are generated as soon as they are parsed and then dropped
+	// along with their scopes, so only the biggest one and the globals
+	// have to fit in memory
+	for (;;)
+	{
+		Scope::Mark scopes = Scope::mark();
+		ASTStore::Mark nodes = asts.mark();
+		Arena::Mark mem = arena.mark();
+
+		AST item = p.parse_next();
+		if (!item)
+			break;
+
+		check_types(item);
+		if (print_tree)
+			prettyprint(item, 0);
+
+		gen_item(item);
+
+		// globals keep their initializers for gen_globls
+		if (item.type() == FUNC)
+		{
+			Scope::rewind(scopes);
+			asts.rewind(nodes);
+			arena.rewind(mem);
+		}
+	}
+
+	if (!emit_module.empty())
+		save_module(emit_module);
+
 	gen_globls();
 }
@@ -0,0 +1,40 @@
+#include <arena.hpp>
+
+#include <cstdlib>
+
+#include <err.hpp>
+
+Arena arena;
+
+void Arena::grow(std::size_t size)
+{
+	// big requests get a block of their own
+	std::size_t len = size > BLOCK ? size : BLOCK;
+
+	char *b = static_cast<char *>(std::malloc(len));
+	if (!b)
+		err("Out of memory");
+
+	blocks.push_back(b);
+	cur = b;
+	end = b + len;
+}
+
+void Arena::rewind(const Mark &m)
+{
+	for (std::size_t i = m.blocks; i < blocks.size(); ++i)
+		std::free(blocks[i]);
+
+	blocks.resize(m.blocks);
+	cur = m.cur;
+	end = m.end;
+}
+
+void Arena::release()
+{
+	for (char *b : blocks)
+		std::free(b);
+
+	blocks.clear();
+	cur = end = nullptr;
+}
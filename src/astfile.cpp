@@ -0,0 +1,699 @@
+#include <astfile.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <codegen.hpp>
+#include <scope.hpp>
+#include <types.hpp>
+#include <err.hpp>
+
+// bump when the layout of anything below changes
+const std::uint32_t AST_VERSION = 5;
+const char AST_MAGIC[4] = { 'c', 'c', 'a', '\0' };
+
+// the sections follow the header in this order, each one starting at a
+// multiple of 4: node types, node ptypes, then lhs, mid, rhs, val and
+// scope_id of every node, the lists, the list kids, the scopes, the
+// symbols, the globals, the param types, the types and the names. node 0 is never stored,
+// and the symbols are the global table followed by the local one.
+// nodes are numbered so that every kid comes before its parent and the
+// root is the last one
+struct AstHeader
+{
+	char magic[4];
+	std::uint32_t version;
+	std::uint32_t node_count;
+	std::uint32_t list_count;
+	std::uint32_t kid_count;
+	std::uint32_t scope_count;
+	std::uint32_t sym_count;
+	// how many of the symbols are in the global table
+	std::uint32_t global_count;
+	// symbols in the global scope that were added to the globals before
+	// parsing, by modules
+	std::uint32_t globl_count;
+	std::uint32_t param_count;
+	std::uint32_t type_count;
+	std::uint32_t str_len;
+	std::uint32_t root;
+};
+
+// kids first to first + count in the kid section
+struct AstList
+{
+	std::uint32_t first, count;
+};
+
+struct AstScope
+{
+	std::int32_t parent, size;
+};
+
+// name is an offset into the names
+struct AstSym
+{
+	std::uint32_t name, len;
+	std::uint8_t vtype, pad[3];
+	std::uint32_t type;
+	std::int32_t val;
+	std::int32_t scope;
+	std::uint32_t params;
+};
+
+static_assert(sizeof(AstHeader) == 52 && sizeof(AstList) == 8 && sizeof(AstScope) == 8
+	&& sizeof(AstSym) == 28 && sizeof(TypeRec) == 12 && sizeof(AST) == 4, "ast file records should be packed");
+
+static std::size_t align4(std::size_t n) { return (n + 3) & ~std::size_t(3); }
+
+// val of a loaded symbol has to make sense for its kind, codegen uses it
+// as a register, a frame offset or a param count
+static bool valid_sym(VarType vtype, int val, bool global)
+{
+	switch (vtype) {
+		case V_GLOBL: return global && (val == 0 || val == 1);
+		case V_FUNC: return global && val >= 0 && val <= MAX_PARAMS;
+		case V_REG: return !global && val >= FIRST_ARG && val < FIRST_ARG + ARG_COUNT;
+		// locals are below rbp and params past the return address
+		case V_VAR: return !global && val && val >= -int(MAX_OBJECT_BYTES) && val <= 8 * (MAX_PARAMS + 2);
+		default: return false;
+	}
+}
+
+// what a node is to its parent. each node is given one by its parent, so
+// a node with none or with two isn't part of a tree
+enum Role : std::uint8_t {
+	R_NONE,
+	// the root, a list of items
+	R_UNIT,
+	// function or global declaration
+	R_ITEM,
+	R_STMT,
+	// a statement break and continue can be in
+	R_LOOP_STMT,
+	// the decl of a for
+	R_DECL,
+	// the FOR under a FOR or FOR_DECL, lhs = body, rhs = post
+	R_FOR_BODY,
+	R_EXPR,
+	// expression or NONE
+	R_OPT,
+	// checked by the parent, vars and lists
+	R_DONE
+};
+
+// checks every node has the kids the passes expect of its type, so
+// nothing has to be checked while compiling. kids come before their
+// parents, so going down from the root every parent is done first
+struct ShapeCheck
+{
+	std::vector<Role> role;
+	bool ok = true;
+
+	ShapeCheck(std::uint32_t n) : role(n + 1, R_NONE) { role[n] = R_UNIT; }
+
+	// optional kids may be missing
+	void give(AST kid, Role r, bool optional = false)
+	{
+		if (!kid)
+			ok &= optional;
+		else if (role[kid.id])
+			ok = false;
+		else
+			role[kid.id] = r;
+	}
+
+	// R_NONE slots have to be empty, R_DONE ones were given already
+	void kids(AST n, Role l, Role m, Role r)
+	{
+		for (auto k : { std::make_pair(n.lhs(), l), std::make_pair(n.mid(), m), std::make_pair(n.rhs(), r) })
+		{
+			if (k.second == R_NONE)
+				ok &= !k.first;
+			else if (k.second != R_DONE)
+				give(k.first, k.second, k.second == R_OPT);
+		}
+	}
+
+	// a list in a slot of its parent, its kids are up to the parent
+	bool list(AST n)
+	{
+		ok &= n.type() == LIST;
+		if (ok)
+			give(n, R_DONE);
+		return ok;
+	}
+
+	// a var of one of the kinds in a slot of its parent
+	bool var(AST n, std::initializer_list<VarType> kinds)
+	{
+		ok &= n.type() == VAR;
+		if (!ok)
+			return false;
+
+		give(n, R_DONE);
+		kids(n, R_NONE, R_NONE, R_NONE);
+		ok &= std::find(kinds.begin(), kinds.end(), n.get_sym().vtype) != kinds.end();
+		return ok;
+	}
+
+	void decl(AST n, VarType kind)
+	{
+		var(n.lhs(), { kind });
+		kids(n, R_DONE, R_NONE, n.type() == DECL_SET ? R_EXPR : R_NONE);
+	}
+
+	void func(AST n)
+	{
+		if (!var(n.lhs(), { V_FUNC }) || !list(n.mid()))
+			return;
+
+		for (AST p : n.mid().kids())
+			var(p, { V_REG, V_VAR });
+
+		ok &= n.mid().kids().size() == std::uint32_t(n.lhs().get_sym().val)
+			&& n.val() <= 0 && n.val() >= -int(MAX_OBJECT_BYTES);
+
+		if (n.rhs() && list(n.rhs()))
+			for (AST kid : n.rhs().kids())
+				give(kid, R_STMT);
+	}
+
+	void expr(AST n)
+	{
+		NodeType t = n.type();
+
+		if (t >= SHR && t <= XOR)
+			kids(n, R_EXPR, R_NONE, R_EXPR);
+		else if (t >= SET && t <= SET_OR)
+		{
+			var(n.lhs(), { V_GLOBL, V_VAR, V_REG });
+			kids(n, R_DONE, R_NONE, R_EXPR);
+		}
+		else if (t == LOGNOT || t == NOT || t == NEG)
+			kids(n, R_EXPR, R_NONE, R_NONE);
+		// these take an lval
+		else if ((t >= UN_INC && t <= PTR) || t == POST_INC || t == POST_DEC)
+		{
+			var(n.lhs(), { V_GLOBL, V_VAR, V_REG, V_FUNC });
+			kids(n, R_DONE, R_NONE, R_NONE);
+		}
+		else if (t == CALL)
+		{
+			if (!var(n.lhs(), { V_FUNC }) || !list(n.rhs()))
+				return;
+
+			for (AST arg : n.rhs().kids())
+				give(arg, R_EXPR);
+
+			ok &= !n.mid() && n.rhs().kids().size() == std::uint32_t(n.lhs().get_sym().val);
+		}
+		else if (t == COND)
+			kids(n, R_EXPR, R_EXPR, R_EXPR);
+		else
+		{
+			ok &= t == VAR || t == INT_CONST;
+			kids(n, R_NONE, R_NONE, R_NONE);
+		}
+	}
+
+	void stmt(AST n, Role self)
+	{
+		switch (n.type()) {
+			case NONE:
+				kids(n, R_NONE, R_NONE, R_NONE);
+				break;
+			case LIST:
+				for (AST kid : n.kids())
+					give(kid, self);
+				break;
+			case DECL:
+			case DECL_SET:
+				decl(n, V_VAR);
+				break;
+			case IF:
+				give(n.lhs(), R_EXPR);
+				give(n.mid(), self);
+				give(n.rhs(), self, true);
+				break;
+			case WHILE:
+			case DO:
+				kids(n, R_EXPR, R_NONE, R_LOOP_STMT);
+				break;
+			case FOR:
+			case FOR_DECL:
+				kids(n, n.type() == FOR ? R_OPT : R_DECL, R_OPT, R_FOR_BODY);
+				break;
+			case BREAK:
+			case CONT:
+				ok &= self == R_LOOP_STMT;
+				kids(n, R_NONE, R_NONE, R_NONE);
+				break;
+			case RET:
+				kids(n, R_OPT, R_NONE, R_NONE);
+				break;
+			default:
+				expr(n);
+				break;
+		}
+	}
+
+	void node(AST n)
+	{
+		Role r = role[n.id];
+		NodeType t = n.type();
+
+		// lists only have the kids in their span
+		if (t == LIST)
+			kids(n, R_NONE, R_NONE, R_NONE);
+
+		switch (r) {
+			case R_NONE:
+				ok = false;
+				break;
+			case R_UNIT:
+				ok &= t == LIST;
+				if (ok)
+					for (AST kid : n.kids())
+						give(kid, R_ITEM);
+				break;
+			case R_ITEM:
+				if (t == FUNC)
+					func(n);
+				else if (t == DECL || t == DECL_SET)
+					decl(n, V_GLOBL);
+				else
+					ok = false;
+				break;
+			case R_STMT:
+			case R_LOOP_STMT:
+				stmt(n, r);
+				break;
+			case R_DECL:
+				ok &= t == DECL || t == DECL_SET;
+				if (ok)
+					decl(n, V_VAR);
+				break;
+			case R_FOR_BODY:
+				ok &= t == FOR;
+				kids(n, R_LOOP_STMT, R_NONE, R_OPT);
+				break;
+			case R_OPT:
+				if (t == NONE)
+					kids(n, R_NONE, R_NONE, R_NONE);
+				else
+					expr(n);
+				break;
+			case R_EXPR:
+				expr(n);
+				break;
+			case R_DONE:
+				break;
+		}
+	}
+};
+
+// byte offsets of every section, from the counts in the header
+struct AstLayout
+{
+	std::size_t type, ptype, lhs, mid, rhs, val, scope_id;
+	std::size_t lists, kids, scopes, syms, globls, params, types, strs, end;
+
+	AstLayout(const AstHeader &h)
+	{
+		std::size_t n = h.node_count;
+
+		type = sizeof(AstHeader);
+		ptype = align4(type + n);
+		lhs = ptype + n * 4;
+		mid = lhs + n * 4;
+		rhs = mid + n * 4;
+		val = rhs + n * 4;
+		scope_id = val + n * 4;
+		lists = scope_id + n * 4;
+		kids = lists + std::size_t(h.list_count) * sizeof(AstList);
+		scopes = kids + std::size_t(h.kid_count) * 4;
+		syms = scopes + std::size_t(h.scope_count) * sizeof(AstScope);
+		globls = syms + std::size_t(h.sym_count) * sizeof(AstSym);
+		params = globls + std::size_t(h.globl_count) * 4;
+		types = params + std::size_t(h.param_count) * 4;
+		strs = types + std::size_t(h.type_count) * sizeof(TypeRec);
+		end = strs + h.str_len;
+	}
+};
+
+// the nodes under root in post order, so kids come first
+static std::vector<AST> post_order(AST root)
+{
+	std::vector<AST> order;
+	// the second of each entry is set once its kids have been pushed
+	std::vector<std::pair<AST, bool>> stack = { { root, false } };
+
+	while (!stack.empty())
+	{
+		auto &top = stack.back();
+		AST n = top.first;
+
+		if (top.second)
+		{
+			stack.pop_back();
+			order.push_back(n);
+			continue;
+		}
+
+		top.second = true;
+
+		if (n.type() == LIST)
+		{
+			ASTList kids = n.kids();
+			for (std::uint32_t i = kids.size(); i-- > 0;)
+				stack.push_back({ kids[i], false });
+		}
+		else
+		{
+			for (AST kid : { n.rhs(), n.mid(), n.lhs() })
+				if (kid)
+					stack.push_back({ kid, false });
+		}
+	}
+
+	return order;
+}
+
+void save_ast(const std::string &filename, AST root)
+{
+	std::vector<AST> order = post_order(root);
+
+	// new id of every node, lists are renumbered in the same order
+	std::vector<std::uint32_t> new_id(asts.type.size());
+	for (std::size_t i = 0; i < order.size(); ++i)
+		new_id[order[i].id] = i + 1;
+
+	auto id = [&](AST a) { return AST(new_id[a.id]); };
+
+	ASTStore out;
+	std::vector<AstList> lists;
+	std::vector<AST> kids;
+
+	for (AST n : order)
+	{
+		int val = n.val();
+
+		if (n.type() == LIST)
+		{
+			val = lists.size();
+			lists.push_back({ static_cast<std::uint32_t>(kids.size()), n.kids().size() });
+
+			for (AST kid : n.kids())
+				kids.push_back(id(kid));
+		}
+
+		out.type.push_back(n.type());
+		out.ptype.push_back(n.ptype());
+		out.lhs.push_back(id(n.lhs()));
+		out.mid.push_back(id(n.mid()));
+		out.rhs.push_back(id(n.rhs()));
+		out.val.push_back(val);
+		out.scope_id.push_back(n.scope_id());
+	}
+
+	AstHeader h = {};
+	std::memcpy(h.magic, AST_MAGIC, sizeof(h.magic));
+	h.version = AST_VERSION;
+	h.node_count = order.size();
+	h.list_count = lists.size();
+	h.kid_count = kids.size();
+	h.scope_count = Scope::count();
+	h.root = order.size();
+
+	std::vector<AstScope> scopes;
+	std::string strs;
+	// each name is only stored once
+	std::unordered_map<Name, std::uint32_t> str_off;
+
+	std::uint32_t global_count = Scope::s(Scope::GLOBAL)->syms.size();
+	// indexed by table id, globals first
+	std::vector<AstSym> syms(global_count + Scope::mark().locals);
+
+	for (int i = 0; i < Scope::count(); ++i)
+	{
+		const Scope *s = Scope::s(i);
+
+		scopes.push_back({ s->parent_id, s->size });
+
+		for (int id : s->syms)
+		{
+			const Sym &sym = Scope::sym(i, id);
+			std::string_view name = name_str(sym.name);
+
+			auto it = str_off.find(sym.name);
+			if (it == str_off.end())
+			{
+				it = str_off.emplace(sym.name, strs.size()).first;
+				strs += name;
+			}
+
+			AstSym &r = syms[i == Scope::GLOBAL ? id : global_count + id];
+			r.name = it->second;
+			r.len = name.size();
+			r.vtype = sym.vtype;
+			r.type = sym.type;
+			r.val = sym.val;
+			r.scope = i;
+			r.params = sym.params;
+		}
+	}
+
+	h.sym_count = syms.size();
+	h.global_count = global_count;
+	h.str_len = strs.size();
+
+	// codegen hasn't run yet, so every global so far came from a module
+	std::vector<std::uint32_t> globl_syms;
+
+	for (const auto &g : globls)
+	{
+		int id = Scope::s(Scope::GLOBAL)->find_local(g.first.name);
+		if (id >= 0 && Scope::sym(Scope::GLOBAL, id).vtype == V_GLOBL)
+			globl_syms.push_back(id);
+	}
+
+	h.globl_count = globl_syms.size();
+
+	// every function's, the symbols point into it
+	const std::vector<Type> &params = Scope::all_params();
+	h.param_count = params.size();
+
+	std::vector<TypeRec> types = save_types();
+	h.type_count = types.size();
+
+	AstLayout at(h);
+
+	std::ofstream f(filename, std::ios::binary);
+	if (!f)
+		err("AST file failed to open");
+
+	auto section = [&](std::size_t offset, const void *data, std::size_t len) {
+		static const char zeros[4] = {};
+		f.write(zeros, offset - static_cast<std::size_t>(f.tellp()));
+		f.write(static_cast<const char *>(data), len);
+	};
+
+	std::size_t n = h.node_count;
+
+	f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+	section(at.type, out.type.data() + 1, n);
+	section(at.ptype, out.ptype.data() + 1, n * 4);
+	section(at.lhs, out.lhs.data() + 1, n * 4);
+	section(at.mid, out.mid.data() + 1, n * 4);
+	section(at.rhs, out.rhs.data() + 1, n * 4);
+	section(at.val, out.val.data() + 1, n * 4);
+	section(at.scope_id, out.scope_id.data() + 1, n * 4);
+	section(at.lists, lists.data(), lists.size() * sizeof(AstList));
+	section(at.kids, kids.data(), kids.size() * 4);
+	section(at.scopes, scopes.data(), scopes.size() * sizeof(AstScope));
+	section(at.syms, syms.data(), syms.size() * sizeof(AstSym));
+	section(at.globls, globl_syms.data(), globl_syms.size() * 4);
+	section(at.params, params.data(), params.size() * 4);
+	section(at.types, types.data(), types.size() * sizeof(TypeRec));
+	section(at.strs, strs.data(), strs.size());
+
+	if (!f)
+		err("AST file could not be written");
+}
+
+AST load_ast(const std::string &filename)
+{
+	if (asts.type.size() != 1 || Scope::count() != 0)
+		err("AST files have to be loaded before anything else");
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		err("Invalid AST file specified");
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		err("AST file could not be read!");
+
+	std::size_t len = st.st_size;
+	if (len < sizeof(AstHeader))
+		err("Invalid AST file " + filename);
+
+	// stays mapped, the list kids are used in place
+	void *base = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED)
+		err("AST file could not be read!");
+
+	const char *data = static_cast<const char *>(base);
+	const AstHeader &h = *reinterpret_cast<const AstHeader *>(data);
+
+	if (std::memcmp(h.magic, AST_MAGIC, sizeof(h.magic)) || h.version != AST_VERSION)
+		err("Invalid AST file " + filename);
+
+	AstLayout at(h);
+	if (len != at.end || h.node_count == 0 || h.root != h.node_count || h.scope_count == 0
+		|| h.global_count > h.sym_count)
+		err("Invalid AST file " + filename);
+
+	auto bad = [&]() { err("Invalid AST file " + filename); };
+
+	std::size_t n = h.node_count;
+
+	// types, nothing was made yet so every type keeps its handle
+	const TypeRec *types = reinterpret_cast<const TypeRec *>(data + at.types);
+	std::vector<Type> type_map;
+
+	if (!load_types(types, h.type_count, type_map))
+		bad();
+
+	for (Type t = 0; t < type_map.size(); ++t)
+		if (type_map[t] != t)
+			bad();
+
+	// nodes
+	auto load = [&](auto &arr, std::size_t offset) {
+		using T = typename std::remove_reference<decltype(arr)>::type::value_type;
+		const T *src = reinterpret_cast<const T *>(data + offset);
+		arr.insert(arr.end(), src, src + n);
+	};
+
+	load(asts.type, at.type);
+	load(asts.ptype, at.ptype);
+	load(asts.lhs, at.lhs);
+	load(asts.mid, at.mid);
+	load(asts.rhs, at.rhs);
+	load(asts.val, at.val);
+	load(asts.scope_id, at.scope_id);
+
+	// lists
+	const AstList *lists = reinterpret_cast<const AstList *>(data + at.lists);
+	const AST *kids = reinterpret_cast<const AST *>(data + at.kids);
+
+	for (std::uint32_t i = 0; i < h.list_count; ++i)
+	{
+		if (std::size_t(lists[i].first) + lists[i].count > h.kid_count)
+			bad();
+
+		asts.lists.push_back({ kids + lists[i].first, lists[i].count });
+	}
+
+	// scopes and symbols
+	const AstScope *scopes = reinterpret_cast<const AstScope *>(data + at.scopes);
+	const AstSym *syms = reinterpret_cast<const AstSym *>(data + at.syms);
+	const char *strs = data + at.strs;
+
+	for (std::uint32_t i = 0; i < h.scope_count; ++i)
+	{
+		const AstScope &r = scopes[i];
+
+		if (r.parent < 0 || std::uint32_t(r.parent) >= h.scope_count)
+			bad();
+
+		Scope::s(Scope::new_scope(r.parent))->size = r.size;
+	}
+
+	// nothing was added yet either, so the symbols can keep their indices
+	const Type *params = reinterpret_cast<const Type *>(data + at.params);
+
+	for (std::uint32_t i = 0; i < h.param_count; ++i)
+		if (params[i] >= type_map.size())
+			bad();
+
+	Scope::add_params(params, h.param_count);
+
+	// adding them in table order gives every symbol its old id
+	for (std::uint32_t i = 0; i < h.sym_count; ++i)
+	{
+		const AstSym &y = syms[i];
+
+		if (std::size_t(y.name) + y.len > h.str_len || y.type >= type_map.size()
+			|| y.scope < 0 || std::uint32_t(y.scope) >= h.scope_count
+			|| (y.scope == Scope::GLOBAL) != (i < h.global_count)
+			|| !valid_sym(static_cast<VarType>(y.vtype), y.val, y.scope == Scope::GLOBAL)
+			|| (y.vtype == V_FUNC && std::size_t(y.params) + y.val > h.param_count))
+			bad();
+
+		Sym sym(static_cast<VarType>(y.vtype), y.type, intern(std::string_view(strs + y.name, y.len)), y.val);
+		sym.params = y.vtype == V_FUNC ? y.params : 0;
+		Scope::s(y.scope)->add(sym);
+	}
+
+	// every id a pass will follow has to be in range, and below the id of
+	// the node it's in, so there are no cycles
+	for (std::size_t i = 1; i <= n; ++i)
+	{
+		AST a(i);
+
+		if (a.type() >= NODE_COUNT || a.ptype() >= type_map.size()
+			|| a.lhs().id >= i || a.mid().id >= i || a.rhs().id >= i
+			|| a.scope_id() < 0 || std::uint32_t(a.scope_id()) >= h.scope_count)
+			bad();
+
+		if (a.type() == LIST)
+		{
+			if (a.val() < 0 || std::uint32_t(a.val()) >= h.list_count)
+				bad();
+
+			for (AST kid : a.kids())
+				if (!kid || kid.id >= i)
+					bad();
+		}
+		else if (a.type() == VAR && (a.val() < 0 || std::uint32_t(a.val())
+			>= (a.scope_id() == Scope::GLOBAL ? h.global_count : h.sym_count - h.global_count)))
+			bad();
+	}
+
+	// the tree has to be one the parser could have made
+	ShapeCheck shape(n);
+	for (std::size_t i = n; i > 0 && shape.ok; --i)
+		shape.node(AST(i));
+
+	if (!shape.ok)
+		bad();
+
+	// same as loading the modules again
+	const std::uint32_t *globl_syms = reinterpret_cast<const std::uint32_t *>(data + at.globls);
+
+	for (std::uint32_t i = 0; i < h.globl_count; ++i)
+	{
+		if (globl_syms[i] >= h.global_count)
+			bad();
+
+		add_globl(Scope::sym(Scope::GLOBAL, globl_syms[i]), AST());
+	}
+
+	return AST(h.root);
+}
@@ -1,427 +1,767 @@
 #include <codegen.hpp>
 
+#include <unordered_map>
+
+#include <ir.hpp>
 #include <types.hpp>
 #include <err.hpp>
 
-// true=free, false=allocated
-bool free_regs[FIRST_ARG] = { true };
-std::vector<std::pair<Sym, AST *>> globls;
-
-// vars
+std::vector<std::pair<Sym, AST>> globls;
+// first entry in globls of each name
+static std::unordered_map<Name, std::size_t> globl_index;
 
 int lbl_n = 1;
 
-// -------- register allocation -------- //
+int label() { return lbl_n++; }
+
+// -------- lowering -------- //
+
+// function being lowered
+static IRFunc *fn;
 
-Reg alloc_reg()
+// blocks break and continue go to
+struct Ctx
 {
-	for (int i = 0; i < FIRST_ARG; ++i)
-	{
-		if (free_regs[i])
-		{
-			free_regs[i] = false;
-			return static_cast<Reg>(i);
-		}
-	}
+	int brk, cont;
+};
+
+// an operator waiting on its operands. step is how far along it is and
+// l holds the value of its first operand. a short circuit or ?: keeps
+// its result and the block after it in out and end, and a call where its
+// args start on call_args in end
+struct OpFrame
+{
+	AST n;
+	int step;
+	VReg l, out;
+	int end;
+	// a condition branches to on_true or on_false instead of giving a
+	// value, a ?: keeps the blocks of its branches in them
+	int on_true, on_false;
+	bool cond;
+};
+
+// shared by nested lower calls, each one works above where it started
+static std::vector<OpFrame> op_stack;
+// values of the args of calls that are being lowered
+static std::vector<VReg> call_args;
+
+static bool is_set(NodeType t)
+{
+	return (t >= SET && t <= SET_OR) || t == DECL_SET;
+}
 
-	err("Ran out of registers");
-	// supress return type warning
-	return NOREG;
+// arithmetic of a binop or compound assignment
+static IROp ir_op(NodeType t)
+{
+	switch (t) {
+		case SET_SHR: case SHR: return IR_SHR;
+		case SET_SHL: case SHL: return IR_SHL;
+		case SET_ADD: case ADD: return IR_ADD;
+		case SET_SUB: case SUB: return IR_SUB;
+		case SET_MUL: case MUL: return IR_MUL;
+		case SET_DIV: case DIV: return IR_DIV;
+		case SET_MOD: case MOD: return IR_MOD;
+		case SET_AND: case AND: return IR_AND;
+		case SET_XOR: case XOR: return IR_XOR;
+		default: return IR_OR;
+	}
 }
 
-void free_reg(Reg reg)
+static Idx cond_code(NodeType t) { return static_cast<Idx>(LE + (t - N_LE)); }
+
+// a constant rhs is used as is instead of going through a register,
+// idiv is the only op that needs one
+static bool imm_rhs(AST n)
 {
-	if (free_regs[reg])
-		err("Attemted to free unallocated register");
-	
-	free_regs[reg] = true;
+	NodeType t = n.type();
+	return n.rhs().type() == INT_CONST && t != DIV && t != MOD
+		&& t != SET_DIV && t != SET_MOD;
 }
 
-void free_all()
+// stores imm if v is NOVREG
+static void store(const Sym &s, VReg v, int imm = 0)
 {
-	for (int i = 0; i < FIRST_ARG; ++i)
-		free_regs[i] = true;
+	Inst &i = fn->emit(IR_STORE, reg_size(s.type), NOVREG, v);
+	i.sym = &s;
+	i.imm = imm;
 }
 
-int label() { return lbl_n++; }
+// value of an assignment, which is what was stored
+static VReg stored(const Sym &s, VReg v)
+{
+	Size sz = p_sizeof(s.type), rs = reg_size(s.type);
+	if (sz == rs)
+		return v;
 
-// -------- gen -------- //
+	VReg out = fn->vreg();
+	fn->emit(IR_WIDEN, rs, out, v).from = sz;
+	return out;
+}
 
-Reg gen_ast(AST *n, Ctx c)
+// last step of an operator, l and r are the values of its operands.
+// r is NOVREG when the rhs is an imm
+static VReg lower_op(AST n, VReg l, VReg r)
 {
-	// assignment operators
-	if ((n->type >= SET && n->type <= SET_OR) || n->type == DECL_SET)
+	NodeType t = n.type();
+	VReg out = fn->vreg();
+	int imm = r == NOVREG && n.rhs() ? n.rhs().val() : 0;
+
+	if (t >= N_LE && t <= N_GT)
 	{
-		// test widening types
-		compat_types(n->lhs->get_sym().type, &n->rhs);
+		Inst &i = fn->emit(IR_SETCC, reg_size(n.lhs().ptype()), out, l, r);
+		i.cc = cond_code(t);
+		i.imm = imm;
+	}
+	// binop, both sides have the same type after check_types
+	else if (t >= SHR && t <= XOR)
+		fn->emit(ir_op(t), reg_size(n.lhs().ptype()), out, l, r).imm = imm;
 
-		Reg rval = gen_ast(n->rhs, Ctx(c, n->type));
+	switch (t) {
+		case INT_CONST:
+			fn->emit(IR_IMM, reg_size(n.ptype()), out).imm = n.val();
+			break;
 
-		if (n->type != SET && n->type != DECL_SET)
-		{
-			Reg lval = gen_ast(n->lhs, Ctx(c, n->type));
+		case VAR:
+			fn->emit(IR_LOAD, reg_size(n.ptype()), out).sym = &n.get_sym();
+			break;
 
-			if (n->type == SET_SUB || n->type == SET_SHR || n->type == SET_SHL)
-				lval = emit_binop(rval, lval, n->type);
-			else if (n->type == SET_DIV || n->type == SET_MOD)
-				lval = emit_div(lval, rval, n->type);
-			else
-				lval = emit_binop(lval, rval, n->type);
-			
-			return set_var(lval, n->lhs->get_sym());
-		}
-		else if (n->type == DECL_SET && n->lhs->get_sym().vtype == V_GLOBL)
-		{
-			add_globl(n->lhs->get_sym(), n->rhs);
-			return NOREG;
-		}
-		else
-			// get rvalue, set lvalue
-			return set_var(rval, n->lhs->get_sym());
-	}
+		case NEG:
+		case NOT:
+			fn->emit(t == NEG ? IR_NEG : IR_NOT, reg_size(n.ptype()), out, l);
+			break;
 
-	// non-binary operations
-	switch (n->type) {
-		case WIDEN:
-			return emit_widen(p_sizeof(n->lhs->ptype), p_sizeof(n->ptype), gen_ast(n->lhs, c));
-		case LIST:
-			if (n->lhs) {
-				gen_ast(n->lhs, Ctx(c, LIST));
-				free_all();
-				if (n->mid) {
-					gen_ast(n->mid, Ctx(c, LIST));
-					free_all();
-					if (n->rhs)
-					{
-						gen_ast(n->rhs, Ctx(c, LIST));
-						free_all();
-					}
-				}
-			}
+		case LOGNOT:
+			fn->emit(IR_SETCC, reg_size(n.lhs().ptype()), out, l).cc = EQ;
+			break;
 
-			// end of list
-			if (n->val > 0)
-				stack_dealloc(n->val);
+		case UN_INC:
+		case UN_DEC:
+		case POST_INC:
+		case POST_DEC: {
+			const Sym &s = n.lhs().get_sym();
+			// a pointer steps over one element
+			const TypeInfo &i = type_info(s.type);
+			int step = i.kind == T_PTR ? type_info(i.of).bytes : 1;
 
-			return NOREG;
+			fn->emit(IR_ADD, reg_size(s.type), out, l).imm = (t == UN_INC || t == POST_INC) ? step : -step;
+			store(s, out);
 
-		case FUNC:
-			if (n->rhs)
-			{
-				emit_func_hdr(n->lhs->get_sym(), n->val);
-				gen_ast(n->rhs, Ctx(c, n->type));
-				emit_epilogue();
-			}
-			return NOREG;
+			// postfix gives the old value
+			return (t == POST_INC || t == POST_DEC) ? l : stored(s, out);
+		}
 
-		case DECL:
-			if (n->lhs->get_sym().vtype == V_GLOBL)
-				add_globl(n->lhs->get_sym(), n->rhs);
-
-			return NOREG;
-
-		case IF:
-			gen_if(n, c);
-			return NOREG;
-		case FOR:
-		case FOR_DECL:
-			gen_for(n, c);
-			return NOREG;
-		case WHILE:
-			gen_while(n, c);
-			return NOREG;
-		case DO:
-			gen_do(n, c);
-			return NOREG;
-		case COND:
-			return gen_cond(n, c);
-		case CALL:
-			return gen_call(n, c);
-		case BREAK:
-			emit_jmp(UNCOND, c.breaklbl);
-			return NOREG;
-		case CONT:
-			emit_jmp(UNCOND, c.contlbl);
-			return NOREG;
-
-		default: break;
+		case REF:
+		case PTR:
+			err("Taking addresses and dereferencing are not supported yet");
 	}
 
-	Reg l, r;
-
-	if (n->lhs)
-		l = gen_ast(n->lhs, Ctx(c, n->type));
+	return out;
+}
 
-	if (n->type == LOGAND)
-		return logic_and_set(l, n, c);
-	else if (n->type == LOGOR)
-		return logic_or_set(l, n, c);
+// r is the value of the rhs, or NOVREG if it is an imm
+static VReg lower_set(AST n, VReg r)
+{
+	const Sym &s = n.lhs().get_sym();
+	NodeType t = n.type();
+	int imm = r == NOVREG ? n.rhs().val() : 0;
 
-	if (n->rhs)
-		r = gen_ast(n->rhs, Ctx(c, n->type, l));
-	
-	// binop
-	if (n->type >= SHR && n->type <= XOR)
+	if (t != SET && t != DECL_SET)
 	{
-		if (!compat_types(n, false))
-			err(std::string("Incompatible types ") + PRIM_NAMES[n->lhs->ptype] + " and " + PRIM_NAMES[n->lhs->ptype]);
-
-		if (n->type == SUB || n->type == SHR || n->type == SHL)
-			return emit_binop(r, l, n->type);
-		else if (n->type == DIV || n->type == MOD)
-			return emit_div(l, r, n->type);
-		else if (n->type >= N_LE && n->type <= N_GT)
-		{
-			// if label is specified
-			if (c.lbl)
-			{
-				cmp_jmp(l, r, n->type, c.lbl);
-				return NOREG;
-			}
-			else
-				return cmp_set(l, r, n->type);
-		}
-		else
-			return emit_binop(l, r, n->type);
+		VReg cur = fn->vreg();
+		fn->emit(IR_LOAD, reg_size(s.type), cur).sym = &s;
+
+		VReg out = fn->vreg();
+		fn->emit(ir_op(t), reg_size(n.ptype()), out, cur, r).imm = imm;
+		r = out;
 	}
-	else if (n->type >= UN_INC && n->type <= PTR)
+	else if (r == NOVREG)
 	{
-		Reg r = emit_unop(l, n->type);
+		store(s, NOVREG, imm);
 
-		if (n->type == UN_INC || n->type == UN_DEC)
-			return set_var(r, n->lhs->get_sym());
-		else
-			return r;
+		// only kept if the value is used
+		VReg out = fn->vreg();
+		fn->emit(IR_IMM, reg_size(s.type), out).imm = imm;
+		return out;
 	}
-	
-	switch (n->type) {
-		case INT_CONST:
-			return emit_int(n->val, p_sizeof(n->ptype));
 
-		case POST_INC:
-		case POST_DEC:
-			return emit_post(l, n->type, n->lhs->get_sym());
+	store(s, r);
+	return stored(s, r);
+}
 
-		case RET:
-			compat_types(n->lhs->get_sym().type, &n->lhs);
-			emit_ret(l, p_sizeof(n->lhs->get_sym().type));
-			free_all();
-			return NOREG;
+// args were lowered by run, they are from first on in call_args
+static VReg lower_call(AST n, std::size_t first)
+{
+	VReg out = fn->vreg();
+	Inst &call = fn->emit(IR_CALL, Quad, out);
+	call.sym = &n.lhs().get_sym();
+	call.t = fn->args.size();
+	call.f = call_args.size() - first;
+
+	// args can have calls of their own, so they go in after all are done
+	fn->args.insert(fn->args.end(), call_args.begin() + first, call_args.end());
+	call_args.resize(first);
+
+	// only the low bits of a narrow return value are set
+	Size sz = p_sizeof(n.ptype()), rs = reg_size(n.ptype());
+	if (sz == rs)
+		return out;
+
+	VReg wide = fn->vreg();
+	fn->emit(IR_WIDEN, rs, wide, out).from = sz;
+	return wide;
+}
 
-		case VAR: {
-			Sym &s = n->get_sym();
+// last step of a condition, l and r are the values of its operands
+static void lower_br(const OpFrame &f, VReg l, VReg r)
+{
+	AST n = f.n;
+	Inst *br;
 
-			if (c.parent == DECL_SET && c.reg != NOREG)
-				return set_var(c.reg, s);
-			// not assigning
-			else
-				return load_var(s);
-		}
+	if (n.type() >= N_LE && n.type() <= N_GT)
+	{
+		br = &fn->emit(IR_BR, reg_size(n.lhs().ptype()), NOVREG, l, r);
+		br->cc = cond_code(n.type());
+		br->imm = r == NOVREG ? n.rhs().val() : 0;
+	}
+	else
+	{
+		br = &fn->emit(IR_BR, reg_size(n.ptype()), NOVREG, l);
+		br->cc = NE;
 	}
 
-	return NOREG;
+	br->t = f.on_true;
+	br->f = f.on_false;
 }
 
-void add_globl(const Sym &s, AST *val)
+// expressions are lowered off an explicit stack, so nesting them as deep
+// as memory allows doesn't grow the native stack. runs the frames from
+// base up, returns the value of the one at base
+static VReg run(std::size_t base)
 {
-	if (val && val->type != INT_CONST)
-		err("Global must be initialized with constant");
-	
-	for (unsigned i = 0; i < globls.size(); ++i)
-		// forward global declaration
-		if (globls[i].first.name == s.name)
+	// value of the last operand that was finished
+	VReg ret = NOVREG;
+
+	while (op_stack.size() > base)
+	{
+		OpFrame &f = op_stack.back();
+		AST n = f.n;
+		NodeType t = n.type();
+
+		// operand to lower next, if any, and where it goes if it's a
+		// condition
+		AST next;
+		bool cond = false;
+
+		if (f.cond)
 		{
-			// has already been forward declared
-			if (val && !globls[i].second)
-			{
-				// replace
-				globls[i].second = val;
-				return;
+			switch (f.step++) {
+				case 0:
+					// not just swaps where it goes
+					while (n.type() == LOGNOT)
+					{
+						std::swap(f.on_true, f.on_false);
+						n = f.n = n.lhs();
+					}
+
+					// a comparison branches on its operands, anything else
+					// on its value
+					next = n.type() >= N_LE && n.type() <= N_GT ? n.lhs() : n;
+					break;
+
+				case 1:
+					if (t >= N_LE && t <= N_GT && !imm_rhs(n))
+					{
+						f.l = ret;
+						next = n.rhs();
+					}
+					else
+						lower_br(f, ret, NOVREG);
+					break;
+
+				case 2:
+					lower_br(f, f.l, ret);
+					break;
 			}
-			// forward declaration after instantiation
-			else if (!val)
-				return;
 		}
+		else if (t == CALL)
+		{
+			ASTList args = n.rhs().kids();
 
-	globls.push_back(std::make_pair(s, val));
-}
+			if (f.step == 0)
+				f.end = call_args.size();
+			else
+				call_args.push_back(ret);
 
-void gen_if(AST *n, Ctx c)
-{
-	int _false = label();
-	int end;
+			if (std::uint32_t(f.step) < args.size())
+				next = args[f.step];
+			else
+				ret = lower_call(n, f.end);
 
-	if (n->rhs)
-		end = label();
+			++f.step;
+		}
+		// conditions in the false branch are walked like else ifs, every
+		// one of them sets the same register. the branches of the one
+		// being lowered wait in on_true and on_false
+		else if (t == COND)
+		{
+			switch (f.step++) {
+				case 0:
+					f.out = fn->vreg();
+					f.end = fn->block();
+					// fallthrough
+
+				case 1:
+					f.on_true = fn->block();
+					f.on_false = fn->block();
+					f.step = 2;
+
+					next = n.lhs();
+					cond = true;
+					break;
+
+				case 2:
+					fn->start(f.on_true);
+					next = n.mid();
+					break;
+
+				case 3:
+					fn->emit(IR_MOV, Quad, f.out, ret);
+					fn->jump(f.end);
+					fn->start(f.on_false);
+
+					if (n.rhs().type() == COND)
+					{
+						f.n = n.rhs();
+						f.step = 1;
+						continue;
+					}
 
-	// if not cond, jump to false
-	cond_jmp(n->lhs, Ctx(c, IF, _false));
-	free_all();
+					next = n.rhs();
+					break;
 
-	// generate true block
-	gen_ast(n->mid, Ctx(c, IF));
-	free_all();
+				case 4:
+					fn->emit(IR_MOV, Quad, f.out, ret);
+					fn->start(f.end);
+					ret = f.out;
+					break;
+			}
+		}
+		else if (is_set(t))
+		{
+			if (imm_rhs(n))
+				ret = lower_set(n, NOVREG);
+			else if (f.step++ == 0)
+				next = n.rhs();
+			else
+				ret = lower_set(n, ret);
+		}
+		else if (t == WIDEN)
+		{
+			if (f.step++ == 0)
+				next = n.lhs();
+			else
+			{
+				Size from = reg_size(n.lhs().ptype()), to = reg_size(n.ptype());
 
-	// jump to the end so that false block isn't executed
-	if (n->rhs)
-		emit_jmp(UNCOND, end);
-	
-	emit_lbl(_false);
+				if (from != to)
+				{
+					VReg out = fn->vreg();
+					fn->emit(IR_WIDEN, to, out, ret).from = from;
+					ret = out;
+				}
+			}
+		}
+		// the low bits are already there, only a type narrower than its
+		// register has to be sign extended again
+		else if (t == TRUNC)
+		{
+			if (f.step++ == 0)
+				next = n.lhs();
+			else
+			{
+				Size sz = p_sizeof(n.ptype()), rs = reg_size(n.ptype());
 
-	if (n->rhs)
-	{
-		// generate else block
-		gen_ast(n->rhs, Ctx(c, IF));
-		free_all();
-		emit_lbl(end);
-	}
-}
+				if (sz != rs)
+				{
+					VReg out = fn->vreg();
+					fn->emit(IR_WIDEN, rs, out, ret).from = sz;
+					ret = out;
+				}
+			}
+		}
+		else if (t == LOGAND || t == LOGOR)
+		{
+			switch (f.step++) {
+				case 0:
+					next = n.lhs();
+					break;
+
+				case 1: {
+					int rhs = fn->block();
+					int skip = fn->block();
+					f.end = fn->block();
+					f.out = fn->vreg();
+
+					Inst &br = fn->emit(IR_BR, reg_size(n.lhs().ptype()), NOVREG, ret);
+					br.cc = NE;
+					br.t = t == LOGAND ? rhs : skip;
+					br.f = t == LOGAND ? skip : rhs;
+
+					// the lhs decided it
+					fn->start(skip);
+					fn->emit(IR_IMM, Long, f.out).imm = t == LOGOR;
+					fn->jump(f.end);
+
+					fn->start(rhs);
+					next = n.rhs();
+					break;
+				}
 
-Reg gen_cond(AST *n, Ctx c)
-{
-	int _false = label();
-	int end = label();
+				case 2:
+					fn->emit(IR_SETCC, reg_size(n.rhs().ptype()), f.out, ret).cc = NE;
+					fn->start(f.end);
+					ret = f.out;
+					break;
+			}
+		}
+		else
+		{
+			switch (f.step++) {
+				case 0:
+					if (n.lhs())
+					{
+						next = n.lhs();
+						break;
+					}
+					ret = NOVREG;
+					++f.step;
+					// fallthrough
 
-	Reg out = alloc_reg();
-	Reg r;
+				case 1:
+					f.l = ret;
 
-	// if not cond, jump to false
-	cond_jmp(n->lhs, Ctx(c, COND, _false));
-	free_all();
+					if (n.rhs() && !imm_rhs(n))
+					{
+						next = n.rhs();
+						break;
+					}
+					ret = lower_op(n, f.l, NOVREG);
+					break;
 
-	// true block
-	r = gen_ast(n->mid, Ctx(c, COND));
-	emit_mov(r, out, Quad);
-	// jump past false block
-	emit_jmp(UNCOND, end);
-	free_all();
+				case 2:
+					ret = lower_op(n, f.l, ret);
+					break;
+			}
+		}
 
-	emit_lbl(_false);
+		if (!next)
+			op_stack.pop_back();
+		else if (cond)
+			// f is no longer valid past here
+			op_stack.push_back({ next, 0, NOVREG, NOVREG, -1, f.on_true, f.on_false, true });
+		else
+			op_stack.push_back({ next, 0, NOVREG, NOVREG, -1, -1, -1, false });
+	}
 
-	// false block
-	r = gen_ast(n->rhs, Ctx(c, COND));
-	emit_mov(r, out, Quad);
+	return ret;
+}
 
-	emit_lbl(end);
+static VReg lower(AST n)
+{
+	std::size_t base = op_stack.size();
+	op_stack.push_back({ n, 0, NOVREG, NOVREG, -1, -1, -1, false });
+	return run(base);
+}
 
-	return out;
+// branch to t if n is true, else to f
+static void lower_cond(AST n, int t, int f)
+{
+	std::size_t base = op_stack.size();
+	op_stack.push_back({ n, 0, NOVREG, NOVREG, -1, t, f, true });
+	run(base);
 }
 
-void gen_while(AST *n, Ctx c)
+// a statement waiting on the ones in it, see lower_stmt. c is what break
+// and continue go to in it, the blocks are the ones it still has to start
+// or jump to
+struct StmtFrame
+{
+	AST n;
+	Ctx c;
+	int step;
+	int cond, body, post, els, end;
+};
+
+// statements are lowered off an explicit stack like expressions. else if
+// ladders are walked in a loop, every branch jumps to one end
+static void lower_stmt(AST root, Ctx ctx)
 {
-	int start = label();
-	int end = label();
+	std::vector<StmtFrame> stack;
 
-	emit_lbl(start);
+	// statement to lower next, if any
+	AST n = root;
+	Ctx c = ctx;
 
-	cond_jmp(n->lhs, Ctx(c, WHILE, end));
+	for (;;)
+	{
+		switch (n.type()) {
+			case NONE:
+				break;
+
+			// locals take no code
+			case DECL:
+				if (n.lhs().get_sym().vtype == V_GLOBL)
+					add_globl(n.lhs().get_sym(), n.rhs());
+				break;
+
+			case LIST:
+			case IF:
+			case FOR:
+			case FOR_DECL:
+			case WHILE:
+			case DO:
+				stack.push_back({ n, c, 0, -1, -1, -1, -1, -1 });
+				break;
+
+			// code after a jump goes in a block nothing jumps to
+			case BREAK:
+				fn->jump(c.brk);
+				fn->start(fn->block());
+				break;
+			case CONT:
+				fn->jump(c.cont);
+				fn->start(fn->block());
+				break;
+
+			case RET: {
+				VReg v = n.lhs().type() == NONE ? NOVREG : lower(n.lhs());
+
+				fn->emit(IR_RET, reg_size(n.ptype()), NOVREG, v);
+				fn->start(fn->block());
+				break;
+			}
 
-	// block
-	gen_ast(n->rhs, Ctx(WHILE, end, start));
-	// jump to start
-	emit_jmp(UNCOND, start);
+			default:
+				lower(n);
+				break;
+		}
 
-	emit_lbl(end);
-}
+		n = AST();
 
-void gen_for(AST *n, Ctx c)
-{
-	int start = label();
-	int post = label();
-	int end = label();
+		// the statement on top goes on until it needs another one lowered
+		while (!n && !stack.empty())
+		{
+			StmtFrame &f = stack.back();
+			AST s = f.n;
+			c = f.c;
+
+			switch (s.type()) {
+				case LIST: {
+					ASTList kids = s.kids();
+					if (std::uint32_t(f.step) < kids.size())
+						n = kids[f.step++];
+					else
+						stack.pop_back();
+					break;
+				}
 
-	// stack_alloc(-n->val);
+				case IF:
+					switch (f.step) {
+						case 0:
+							f.end = fn->block();
+							// fallthrough
+
+						case 1: {
+							int t = fn->block();
+							f.els = s.rhs() ? fn->block() : f.end;
+
+							lower_cond(s.lhs(), t, f.els);
+
+							fn->start(t);
+							n = s.mid();
+							f.step = 2;
+							break;
+						}
+
+						case 2:
+							fn->jump(f.end);
+
+							if (!s.rhs())
+							{
+								fn->start(f.end);
+								stack.pop_back();
+								break;
+							}
+
+							fn->start(f.els);
+
+							if (s.rhs().type() == IF)
+							{
+								f.n = s.rhs();
+								f.step = 1;
+								break;
+							}
+
+							n = s.rhs();
+							f.step = 3;
+							break;
+
+						case 3:
+							fn->start(f.end);
+							stack.pop_back();
+							break;
+					}
+					break;
 
-	// init
-	gen_ast(n->lhs, Ctx(c, FOR));
-	emit_lbl(start);
+				case WHILE:
+					if (f.step++ == 0)
+					{
+						f.cond = fn->block();
+						f.body = fn->block();
+						f.end = fn->block();
 
-	// gen conditional jump if the jump isn't none
-	if (n->mid->type != NONE)
-		gen_ast(n->mid, Ctx(c, FOR, end));
+						fn->start(f.cond);
+						lower_cond(s.lhs(), f.body, f.end);
 
-	// block
-	gen_ast(n->rhs->lhs, Ctx(FOR, end, post));
+						fn->start(f.body);
+						n = s.rhs();
+						c = { f.end, f.cond };
+					}
+					else
+					{
+						fn->jump(f.cond);
+						fn->start(f.end);
+						stack.pop_back();
+					}
+					break;
+
+				case FOR:
+				case FOR_DECL:
+					switch (f.step++) {
+						case 0:
+							f.cond = fn->block();
+							f.body = fn->block();
+							f.post = fn->block();
+							f.end = fn->block();
+
+							// init
+							n = s.lhs();
+							break;
+
+						case 1:
+							fn->start(f.cond);
+							if (s.mid().type() != NONE)
+								lower_cond(s.mid(), f.body, f.end);
+
+							fn->start(f.body);
+							n = s.rhs().lhs();
+							c = { f.end, f.post };
+							break;
+
+						case 2:
+							fn->start(f.post);
+							n = s.rhs().rhs();
+							break;
+
+						case 3:
+							fn->jump(f.cond);
+							fn->start(f.end);
+							stack.pop_back();
+							break;
+					}
+					break;
 
-	// post stmt
-	emit_lbl(post);
-	gen_ast(n->rhs->rhs, Ctx(c, FOR));
+				case DO:
+					if (f.step++ == 0)
+					{
+						f.body = fn->block();
+						f.cond = fn->block();
+						f.end = fn->block();
 
-	// jump to start
-	emit_jmp(UNCOND, start);
+						fn->start(f.body);
+						n = s.rhs();
+						c = { f.end, f.cond };
+					}
+					else
+					{
+						fn->start(f.cond);
+						lower_cond(s.lhs(), f.body, f.end);
 
-	emit_lbl(end);
+						fn->start(f.end);
+						stack.pop_back();
+					}
+					break;
+			}
+		}
 
-	stack_dealloc(n->val);
+		if (!n)
+			return;
+	}
 }
 
-void gen_do(AST *n, Ctx c)
+IRFunc lower_func(AST n)
 {
-	int start = label();
-	int end = label();
+	const Sym &s = n.lhs().get_sym();
+	IRFunc f(s, -n.val(), std::min(s.val, ARG_COUNT));
+	fn = &f;
+
+	f.start(f.block());
+	lower_stmt(n.rhs(), { -1, -1 });
 
-	emit_lbl(start);
+	// falling off the end returns 0
+	if (!f.blocks[f.cur].done())
+		f.emit(IR_RET, Long);
+
+	f.finish();
+	return f;
+}
 
-	// block
-	gen_ast(n->rhs, Ctx(DO, end, start));
-	// TODO: could be one jump if jnz to start
-	cond_jmp(n->lhs, Ctx(c, DO, end));
+void gen_item(AST n)
+{
+	switch (n.type()) {
+		case LIST:
+			for (AST kid : n.kids())
+				gen_item(kid);
+			break;
 
-	// jump to start
-	emit_jmp(UNCOND, start);
+		case FUNC:
+			if (n.rhs())
+				select_func(lower_func(n));
+			break;
 
-	emit_lbl(end);
+		case DECL:
+		case DECL_SET:
+			add_globl(n.lhs().get_sym(), n.rhs());
+			break;
+	}
 }
 
-Reg gen_call(AST *n, Ctx c)
+void add_globl(const Sym &s, AST val)
 {
-	bool pushed_regs[6] = {0};
-	// push registers in use
-	for (int i = 0; i < FIRST_ARG; ++i)
-		if (!free_regs[i])
-		{
-			emit_push(static_cast<Reg>(i));
-			pushed_regs[i] = true;
-		}
+	if (val && val.type() != INT_CONST)
+		err("Global must be initialized with constant");
 
-	ASTIter i(n->rhs);
+	auto it = globl_index.find(s.name);
 
-	int offset = 0;
-	int count = 0;
-	while (i.has_next())
+	// forward global declaration
+	if (it != globl_index.end())
 	{
-		Reg r = gen_ast(i.next(), Ctx(c, CALL));
+		AST &prev = globls[it->second].second;
 
-		if (count < ARG_COUNT)
+		// has already been forward declared
+		if (val && !prev)
 		{
-			Reg arg = static_cast<Reg>(FIRST_ARG + count);
-			emit_push(arg);
-			emit_mov(r, arg, Quad);
+			// replace
+			prev = val;
+			return;
 		}
-		else
-			emit_mov(r, (offset -= 8), Quad);
-		
-		++count;
+		// forward declaration after instantiation
+		else if (!val)
+			return;
 	}
+	else
+		globl_index.emplace(s.name, globls.size());
 
-	if (count > 6)
-		stack_alloc(offset);
-	
-	emit_call(n->lhs->get_sym().name);
-
-	if (count > 6)
-		stack_dealloc(-offset);
-	
-	// pop saved regs
-	for (int i = std::min(5, count - 1); i >= 0; --i)
-		emit_pop(static_cast<Reg>(FIRST_ARG + i));
-
-	// pop prev saved regs
-	for (int i = FIRST_ARG - 1; i >= 0; --i)
-		if (pushed_regs[i])
-			emit_pop(static_cast<Reg>(i));
-	
-	Reg out = alloc_reg();
-
-	return emit_mov(static_cast<Reg>(FIRST_ARG + ARG_COUNT), out, Quad);
+	globls.push_back(std::make_pair(s, val));
 }
@@ -6,16 +6,13 @@ const char *PRIM_NAMES[P_COUNT] = {
 	"int",
 	"char",
 	"long",
-	"void ptr",
-	"int ptr",
-	"char ptr",
-	"long ptr",
 };
 
 // yes
 const char *NODE_NAMES[NODE_COUNT] = {
 	"none",
 	"widen",
+	"trunc",
 	"list",
 	"if",
 	"for",
@@ -1,14 +1,24 @@
 #include <err.hpp>
+#include <preproc.hpp>
 
 const char *red = "\033[0;31m";
 const char *nc = "\033[0m";
 
-void err_tok(const std::string &msg, Token t)
+void err_tok(const std::string &msg, const Preproc &pp, const Token &t)
+{
+	err_at(msg, pp.pos(t.offset));
+}
+
+void err_at(const std::string &msg, const SrcPos &pos)
 {
 	std::cerr << msg
-			  << " at line " << t.line
-			  << ", col " << t.col
-			  << '\n';
+			  << " at line " << pos.line
+			  << ", col " << pos.col;
+
+	if (!pos.file.empty())
+		std::cerr << " in " << pos.file;
+
+	std::cerr << '\n';
 
 	exit(1);
 }
@@ -0,0 +1,27 @@
+#include <intern.hpp>
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+// deque so that the views used as keys stay valid as it grows
+static std::deque<std::string> strs;
+static std::unordered_map<std::string_view, Name> ids;
+
+Name intern(std::string_view s)
+{
+	auto it = ids.find(s);
+	if (it != ids.end())
+		return it->second;
+
+	Name n = strs.size();
+	strs.emplace_back(s);
+	ids.emplace(strs.back(), n);
+
+	return n;
+}
+
+std::string_view name_str(Name n)
+{
+	return strs[n];
+}
@@ -0,0 +1,219 @@
+#include <ir.hpp>
+
+#include <algorithm>
+
+int IRFunc::block()
+{
+	blocks.emplace_back();
+	blocks.back().lbl = label();
+	return blocks.size() - 1;
+}
+
+void IRFunc::start(int b)
+{
+	if (cur >= 0)
+		jump(b);
+
+	cur = b;
+	order.push_back(b);
+}
+
+void IRFunc::jump(int b)
+{
+	if (!blocks[cur].done())
+		emit(IR_JMP, Quad).t = b;
+}
+
+Inst &IRFunc::emit(IROp op, Size size, VReg dst, VReg a, VReg b)
+{
+	Inst i = {};
+	i.op = op;
+	i.size = size;
+	i.dst = dst;
+	i.a = a;
+	i.b = b;
+
+	std::vector<Inst> &insts = blocks[cur].insts;
+	insts.push_back(i);
+	return insts.back();
+}
+
+// -------- analysis -------- //
+
+// only computes its dst, so it can go if that is never used
+static bool pure(IROp op)
+{
+	return op <= IR_LOAD || (op >= IR_ADD && op <= IR_NOT);
+}
+
+// calls f on every virtual register i reads
+template <typename F>
+static void uses(const IRFunc &fn, const Inst &i, F f)
+{
+	if (i.a != NOVREG)
+		f(i.a);
+	if (i.b != NOVREG)
+		f(i.b);
+
+	if (i.op == IR_CALL)
+		for (int k = 0; k < i.f; ++k)
+			f(fn.args[i.t + k]);
+}
+
+// where a jump to each block ends up, past blocks that do nothing but
+// jump on. every block on a chain gets the end of it, so each chain is
+// only walked once
+std::vector<int> IRFunc::targets() const
+{
+	// -1 is not known yet, -2 is on the chain being walked
+	std::vector<int> to(blocks.size(), -1);
+	std::vector<int> chain;
+
+	auto jumps = [&](int b) {
+		const std::vector<Inst> &insts = blocks[b].insts;
+		return insts.size() == 1 && insts[0].op == IR_JMP;
+	};
+
+	for (int b = 0; b < int(blocks.size()); ++b)
+	{
+		int cur = b;
+
+		while (to[cur] == -1 && jumps(cur))
+		{
+			to[cur] = -2;
+			chain.push_back(cur);
+			cur = blocks[cur].insts[0].t;
+		}
+
+		// a loop of empty blocks stops where it closes
+		int end = to[cur] >= 0 ? to[cur] : cur;
+		if (to[cur] == -1)
+			to[cur] = cur;
+
+		for (int c : chain)
+			to[c] = end;
+		chain.clear();
+	}
+
+	return to;
+}
+
+void IRFunc::finish()
+{
+	std::vector<int> to = targets();
+
+	// cfg
+	for (Block &b : blocks)
+	{
+		// never started
+		if (b.insts.empty())
+			continue;
+
+		Inst &last = b.insts.back();
+
+		if (last.op == IR_JMP)
+		{
+			last.t = to[last.t];
+			b.succs = { last.t };
+		}
+		else if (last.op == IR_BR)
+		{
+			last.t = to[last.t];
+			last.f = to[last.f];
+			b.succs = { last.t, last.f };
+		}
+	}
+
+	// blocks after a break or return are never reached
+	std::vector<bool> seen(blocks.size());
+	std::vector<int> stack = { order.front() };
+	seen[order.front()] = true;
+
+	while (!stack.empty())
+	{
+		int b = stack.back();
+		stack.pop_back();
+
+		for (int s : blocks[b].succs)
+		{
+			blocks[s].preds.push_back(b);
+
+			if (!seen[s])
+			{
+				seen[s] = true;
+				stack.push_back(s);
+			}
+		}
+	}
+
+	order.erase(std::remove_if(order.begin(), order.end(),
+		[&](int b) { return !seen[b]; }), order.end());
+
+	// dead instructions, removing one can make its operands dead too
+	std::vector<int> use_count(vregs);
+
+	for (int b : order)
+		for (const Inst &i : blocks[b].insts)
+			uses(*this, i, [&](VReg v) { ++use_count[v]; });
+
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+
+		for (auto b = order.rbegin(); b != order.rend(); ++b)
+		{
+			std::vector<Inst> &insts = blocks[*b].insts;
+			std::vector<bool> dead(insts.size());
+
+			for (std::size_t k = insts.size(); k-- > 0;)
+			{
+				const Inst &i = insts[k];
+
+				if (!pure(i.op) || use_count[i.dst])
+					continue;
+
+				uses(*this, i, [&](VReg v) { --use_count[v]; });
+				dead[k] = true;
+				changed = true;
+			}
+
+			std::size_t kept = 0;
+			for (std::size_t k = 0; k < insts.size(); ++k)
+				if (!dead[k])
+					insts[kept++] = insts[k];
+			insts.resize(kept);
+		}
+	}
+}
+
+std::vector<Interval> IRFunc::intervals() const
+{
+	std::vector<int> at(vregs, -1);
+	std::vector<Interval> out;
+	int pos = 0;
+
+	auto see = [&](VReg v) {
+		if (at[v] < 0)
+		{
+			at[v] = out.size();
+			out.push_back({ v, pos, pos });
+		}
+		else
+			out[at[v]].end = pos;
+	};
+
+	// registers are seen in order of their first def, so out is sorted
+	for (int b : order)
+	{
+		for (const Inst &i : blocks[b].insts)
+		{
+			uses(*this, i, see);
+			if (i.dst != NOVREG)
+				see(i.dst);
+
+			++pos;
+		}
+	}
+
+	return out;
+}
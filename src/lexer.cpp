@@ -1,32 +1,216 @@
 #include <lexer.hpp>
 
 #include <cstring>
-#include <sstream>
-#include <fstream>
-#include <cstring>
-#include <cctype>
 #include <string>
 #include <limits>
+#include <cstdlib>
+#include <algorithm>
+
+#include <thread>
+#include <atomic>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <codegen.hpp>
+#include <scan.hpp>
+#include <err.hpp>
 
 const int STR_TOK_LEN = OP_LT - 1;
 
-const char *KEYWORDS[STR_TOK_LEN] = {
+constexpr const char *KEYWORDS[STR_TOK_LEN] = {
 #define DEF(type, str) str "\0",
 	TOKS
 #undef DEF
 };
 
+// -------- keyword hash -------- //
+
+constexpr std::size_t c_strlen(const char *s)
+{
+	std::size_t len = 0;
+	while (s[len])
+		++len;
+	return len;
+}
+
+// keywords have to come before operators in TOKS
+constexpr bool keywords_first()
+{
+	for (int i = 0; i < STR_TOK_LEN; ++i)
+		if (is_alpha(KEYWORDS[i][0]) != (i < OP_SHR_SET - 1))
+			return false;
+	return true;
+}
+
+static_assert(keywords_first(), "TOKS must list all keywords before OP_SHR_SET");
+
+const int KW_BITS = 6;
+
+// only looks at the first char, last char, and length so that the text
+// of an identifier is never walked twice
+constexpr unsigned kw_hash(const char *s, std::size_t len, unsigned seed)
+{
+	unsigned key = static_cast<unsigned char>(s[0]) * 31u
+		+ static_cast<unsigned char>(s[len - 1])
+		+ static_cast<unsigned>(len) * 977u;
+
+	return (key * seed) >> (32 - KW_BITS);
+}
+
+struct KwSlot
+{
+	TokType type;
+	std::size_t len;
+};
+
+struct KwTable
+{
+	unsigned seed;
+	KwSlot slots[1 << KW_BITS];
+};
+
+// search for a multiplier that gives every keyword its own slot
+constexpr KwTable make_kw_table()
+{
+	for (unsigned seed = 0x9e3779b1u; ; seed += 2)
+	{
+		KwTable table = {};
+		table.seed = seed;
+
+		bool ok = true;
+		for (int i = 0; ok && i < OP_SHR_SET - 1; ++i)
+		{
+			std::size_t len = c_strlen(KEYWORDS[i]);
+			KwSlot &slot = table.slots[kw_hash(KEYWORDS[i], len, seed)];
+
+			if (slot.type != TOK_EOF)
+				ok = false;
+
+			slot = { static_cast<TokType>(i + 1), len };
+		}
+
+		if (ok)
+			return table;
+	}
+}
+
+constexpr KwTable KW_TABLE = make_kw_table();
+
+// IDENTIFIER if the text is not a keyword
+static TokType keyword_type(const char *s, std::size_t len)
+{
+	const KwSlot &slot = KW_TABLE.slots[kw_hash(s, len, KW_TABLE.seed)];
+
+	if (slot.len == len && std::memcmp(KEYWORDS[slot.type - 1], s, len) == 0)
+		return slot.type;
+
+	return IDENTIFIER;
+}
+
 const char *NAMES[TOK_COUNT - IDENTIFIER] = {
 	"identifier",
 	"integer constant",
 	"floating constant",
 	"character constant",
 	"string constant",
+	"'#'",
+	"end of line",
+	"skipped group",
+};
+
+constexpr char CHAR_TOKENS[] = "<>;=+-*/,[](){}&|%!~^.?:";
+
+// -------- operator dfa -------- //
+
+// class 0 is for chars that can't appear in an operator
+const int OP_CLASSES = sizeof(CHAR_TOKENS);
+const int OP_STATES = 64;
+
+struct OpDfa
+{
+	bool ok;
+	unsigned char cls[256];
+	// 0 means no transition, the start state is never re-entered
+	unsigned char next[OP_STATES][OP_CLASSES];
+	TokType accept[OP_STATES];
 };
 
-const char CHAR_TOKENS[] = "<>;=+-*/,[](){}&|%!~^.?:";
+constexpr bool op_insert(OpDfa &dfa, int &states, const char *s, TokType t)
+{
+	int state = 0;
+
+	for (; *s; ++s)
+	{
+		int c = dfa.cls[static_cast<unsigned char>(*s)];
+		if (!c)
+			return false;
+
+		if (!dfa.next[state][c])
+		{
+			if (states == OP_STATES)
+				return false;
+			dfa.next[state][c] = states++;
+		}
+
+		state = dfa.next[state][c];
+	}
+
+	dfa.accept[state] = t;
+	return true;
+}
+
+// trie over every operator string, which is already a dfa
+constexpr OpDfa make_op_dfa()
+{
+	OpDfa dfa = {};
+	dfa.ok = true;
+
+	for (int i = 0; CHAR_TOKENS[i]; ++i)
+		dfa.cls[static_cast<unsigned char>(CHAR_TOKENS[i])] = i + 1;
+
+	int states = 1;
+
+	for (int i = 0; dfa.ok && CHAR_TOKENS[i]; ++i)
+	{
+		const char s[2] = { CHAR_TOKENS[i], '\0' };
+		dfa.ok = op_insert(dfa, states, s, static_cast<TokType>(OP_LT + i));
+	}
+
+	for (int i = OP_SHR_SET - 1; dfa.ok && i < STR_TOK_LEN; ++i)
+		dfa.ok = op_insert(dfa, states, KEYWORDS[i], static_cast<TokType>(i + 1));
+
+	return dfa;
+}
+
+constexpr OpDfa OP_DFA = make_op_dfa();
+
+static_assert(OP_DFA.ok, "operators in TOKS must be made of CHAR_TOKENS");
+
+// longest operator at s, sets len, TOK_EOF if there is none
+static TokType match_op(const char *s, std::size_t &len)
+{
+	TokType out = TOK_EOF;
+	int state = 0;
+
+	for (std::size_t i = 0; ; ++i)
+	{
+		state = OP_DFA.next[state][OP_DFA.cls[static_cast<unsigned char>(s[i])]];
+		if (!state)
+			return out;
+
+		if (OP_DFA.accept[state] != TOK_EOF)
+		{
+			out = OP_DFA.accept[state];
+			len = i + 1;
+		}
+	}
+}
+
+// thrown by lex_err on pool threads
+struct LexAbort {};
 
 char esc_code(char c)
 {
@@ -43,66 +227,156 @@ char esc_code(char c)
 	}
 }
 
-Lexer::Lexer(const std::string &filename)
-	: index(0), line(1), col(1)
+Lexer::Lexer(const std::string &filename, bool header)
+	: index(0), buf_pos(0), map_len(0), fd(-1), eof(true), dropped('\n'), directive(false)
+	, name(header ? filename : ""), lines_scanned(0), lines(1, { 0, 1 }), released(0), lexed_to(0)
+	, worker(false), cur_chunk(0)
 {
-	std::ifstream file(filename, std::ifstream::binary);
+	int file = filename == "-" ? STDIN_FILENO : open(filename.c_str(), O_RDONLY);
 
-	if (!file)
-		lex_err("Invalid file specified");
+	if (file < 0)
+		err("Invalid file specified");
 
 	// get len
-	file.seekg(0, file.end);
-	int len = file.tellg();
-	file.seekg(0, file.beg);
+	struct stat st;
+	if (fstat(file, &st) < 0)
+	{
+		close(file);
+		err("File could not be read!");
+	}
+
+	// pipes and stdin are read in chunks as the lexer goes
+	if (!S_ISREG(st.st_mode))
+	{
+		fd = file;
+		eof = false;
+		visible = filled = 0;
+		window.resize(1);
+		held = '\0';
+		buf = window.data();
+		refill();
+		return;
+	}
+
+	std::size_t len = st.st_size;
+
+	// tokens store 32 bit offsets
+	if (len > UINT32_MAX)
+	{
+		close(file);
+		err("File is too large");
+	}
+
+	// round up to at least one page past the end of the file, so there
+	// is always a '\0' after the last char, even if len is page aligned
+	std::size_t page = sysconf(_SC_PAGESIZE);
+	map_len = (len / page + 1) * page;
+
+	// reserve zeroed pages, then map the file over the front of them
+	void *base = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	bool mapped = base != MAP_FAILED
+		&& (!len || mmap(base, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, file, 0) != MAP_FAILED);
+
+	close(file);
 
-	// alloc and set buf
-	buf = new char[len + 1];
-	file.read(buf, len);
-	buf[len] = '\0';
+	if (!mapped)
+	{
+		if (base != MAP_FAILED)
+			munmap(base, map_len);
+		err("File could not be read!");
+	}
 
-	if (!file)
-		lex_err("File could not be read!");
+	madvise(base, map_len, MADV_SEQUENTIAL);
+	buf = static_cast<const char *>(base);
+	visible = filled = len;
 
-	file.close();
+	if (len >= PARALLEL_MIN && std::thread::hardware_concurrency() > 1)
+		prelex();
+}
 
-	// move past newlines
-	count(0);
+Lexer::Lexer(const Lexer &whole, std::size_t start)
+	: index(start), buf_pos(0), visible(whole.visible), buf(whole.buf), map_len(0), fd(-1), eof(true)
+	, dropped('\n'), directive(false), lines_scanned(0), lines(1, { 0, 1 }), released(0), lexed_to(0)
+	, worker(true), cur_chunk(0)
+{
 }
 
 Lexer::~Lexer()
 {
-	delete[] buf;
+	if (map_len)
+		munmap(const_cast<char *>(buf), map_len);
+	if (fd > STDIN_FILENO)
+		close(fd);
 }
 
-Token Lexer::eat(TokType expected)
+bool Lexer::refill()
 {
-	Token next = peek();
-	if (next.type != expected)
+	if (eof)
+		return false;
+
+	// only keep the token being lexed
+	std::size_t keep = index;
+
+	// line starts have to be found before the bytes are dropped
+	scan_lines();
+	trim_lines();
+
+	window[visible] = held;
+	for (std::size_t i = keep; i > 0; --i)
+		if (window[i - 1] == '\n' || !is_space(window[i - 1]))
+		{
+			dropped = window[i - 1];
+			break;
+		}
+	window.erase(window.begin(), window.begin() + keep);
+	buf_pos += keep;
+	index -= keep;
+	visible -= keep;
+	filled -= keep;
+
+	// end the window after a whitespace char, so that only strings and
+	// comments can run past it
+	std::size_t from = visible;
+	for (;;)
 	{
-		if (expected == SEMI)
-			lex_err("Expected a \';\'");
-		else
+		std::size_t end = filled;
+		while (end > from && !is_space(window[end - 1]))
+			--end;
+
+		if (end > from)
+		{
+			visible = end;
+			break;
+		}
+		else if (eof)
 		{
-			std::stringstream out;
-		
-			out << "Invalid token: expected "
-				<< getname(expected)
-				<< ", got "
-				<< getname(next.type);
-
-			lex_err(out.str());
+			visible = filled;
+			break;
 		}
+
+		window.resize(filled + CHUNK + 1);
+		ssize_t n = read(fd, window.data() + filled, CHUNK);
+
+		if (n < 0)
+			err("File could not be read!");
+		else if (n == 0)
+			eof = true;
+
+		from = filled;
+		filled += n;
 	}
 
-	// remove cached value
-	if (tok_buf.size() > 0)
-		tok_buf.pop_front();
-	
-	return next;
+	if (buf_pos + filled > UINT32_MAX)
+		lex_err("File is too large");
+
+	held = window[visible];
+	window[visible] = '\0';
+	buf = window.data();
+
+	return true;
 }
 
-Token Lexer::next()
+Token Lexer::lex()
 {
 	for (;;)
 	{
@@ -110,12 +384,38 @@ Token Lexer::next()
 
 		// has to be first check, otherwise buffer overflow from buf[index + 1]
 		if (cur == '\0')
-			return Token(TOK_EOF, line, col, 0);
+		{
+			if (index == visible && refill())
+				continue;
+
+			if (directive)
+			{
+				directive = false;
+				return Token(PP_EOL, buf_pos + index, 0);
+			}
+
+			return Token(TOK_EOF, buf_pos + index, 0);
+		}
 
 		// ignored characters
-		if (cur == ' ' || cur == '\t' || cur == '\v' || cur == '\f')
+		if (is_space(cur))
 		{
-			count(1);
+			if (!directive)
+			{
+				index = skip_space(buf + index) - buf;
+				continue;
+			}
+
+			// directives are short, no need for simd
+			while (cur != '\n' && is_space(cur))
+				cur = buf[++index];
+
+			if (cur == '\n')
+			{
+				directive = false;
+				return Token(PP_EOL, buf_pos + index++, 1);
+			}
+
 			continue;
 		}
 
@@ -126,13 +426,11 @@ Token Lexer::next()
 
 			if (next == '/')
 			{
-				int len = 0;
-				while (buf[index + len] != '\n')
-				{
-					++len;
-				}
+				// drop the part of the comment read so far if it runs past the window
+				do
+					index = find_char(buf + index, '\n') - buf;
+				while (index == visible && refill());
 
-				count(len);
 				continue;
 			}
 			else if (next == '*')
@@ -144,6 +442,10 @@ Token Lexer::next()
 
 		if (cur == '\'')
 		{
+			// need all of it in the window
+			if (visible - index < 4 && refill())
+				continue;
+
 			bool esc = false;
 			char out = buf[index + 1];
 
@@ -160,17 +462,17 @@ Token Lexer::next()
 			else if (buf[index + 2] != '\'')
 				lex_err("Unterminated character constant");
 
-			Token tok(CHAR_CONSTANT, line, col, esc ? 2 : 1);
-			tok.val = static_cast<long long>(out);
+			Token tok(CHAR_CONSTANT, buf_pos + index, esc ? 4 : 3);
+			tok.ival = out;
 
-			count(esc ? 4 : 3);
+			index += tok.len;
 			return tok;
 		}
 
 		// check for numeric constant
-		if (std::isdigit(cur) || cur == '.')
+		if (is_digit(cur) || cur == '.')
 		{
-			int end = index;
+			std::size_t end = index;
 			int base = 10;
 			bool fp = false;
 
@@ -183,7 +485,7 @@ Token Lexer::next()
 				{
 					do
 						cur = buf[++end];
-					while (std::isdigit(cur) || (cur >= 'a' && cur <= 'f') || (cur >= 'A' && cur <= 'F'));
+					while (is_digit(cur) || (cur >= 'a' && cur <= 'f') || (cur >= 'A' && cur <= 'F'));
 
 					if (end - index < 3)
 						lex_err("Invalid hex constant");
@@ -225,20 +527,26 @@ Token Lexer::next()
 			// dec
 			else
 			{
-				do
+				for (;;)
 				{
-					if (cur == '.')
-					{
-						if (fp)
-							lex_err("Invalid floating point constant: multiple \'.\'s");
-						fp = true;
-					}
-					cur = buf[++end];
-				} while (std::isdigit(cur) || cur == '.');
+					end = skip_digits(buf + end) - buf;
+					cur = buf[end];
+
+					if (cur != '.')
+						break;
+
+					if (fp)
+						lex_err("Invalid floating point constant: multiple \'.\'s");
+					fp = true;
+					++end;
+				}
 
 				// cannot have single '.'
 				if (end - index == 1 && buf[index] == '.')
+				{
+					cur = '.';
 					goto NUMCHECK_END;
+				}
 			}
 
 			bool fsuffix = false;
@@ -246,7 +554,7 @@ Token Lexer::next()
 			int lcount = 0;
 
 			// suffixes
-			while (std::isalpha(cur))
+			while (is_alpha(cur))
 			{
 				if (cur == 'f')
 				{
@@ -282,111 +590,91 @@ Token Lexer::next()
 				cur = buf[++end];
 			}
 
-			int len = end - index;
+			std::size_t len = end - index;
 
-			std::string numbuf;
-			// for some reason stoll doesnt like 0b but works with 0x
-			if (base == 2)
-				numbuf = std::string(buf + index + 2, len - 2);
-			else
-				numbuf = std::string(buf + index, len);
+			if (len > MAX_TOKEN_LEN)
+				lex_err("Numeric constant is too long");
 
-			Token out(INT_CONSTANT, line, col, len);
+			Token out(INT_CONSTANT, buf_pos + index, len);
 
+			// parse in place, the suffix or next token stops the conversion
 			if (fp)
 			{
 				out.type = FP_CONSTANT;
-				out.val = std::stod(numbuf);
+				out.fval = std::strtod(buf + index, nullptr);
 			}
+			// for some reason strtoll doesnt like 0b but works with 0x
+			else if (base == 2)
+				out.ival = std::strtoll(buf + index + 2, nullptr, base);
 			else
-				out.val = std::stoll(numbuf, 0, base);
+				out.ival = std::strtoll(buf + index, nullptr, base);
 
-			count(len);
+			index += len;
 			return out;
 		} NUMCHECK_END:
 
-		// check all keywords
-		for (int i = 0; i < STR_TOK_LEN; ++i)
+		// identifier or keyword
+		if (is_alpha(cur) || cur == '_')
 		{
-			if (keyword(KEYWORDS[i]))
-			{
-				int len = std::strlen(KEYWORDS[i]);
-				Token out(static_cast<TokType>(i + 1), line, col, len);
-				count(len);
-				return out;
-			}
+			std::size_t len = skip_ident(buf + index) - (buf + index);
+
+			if (len > MAX_TOKEN_LEN)
+				lex_err("Identifier is too long");
+
+			Token out(keyword_type(buf + index, len), buf_pos + index, len);
+			if (out.type == IDENTIFIER && !worker)
+				out.name = intern(std::string_view(buf + index, len));
+			index += len;
+			return out;
 		}
 
-		// check single char constants
-		int i = 0;
-		while (CHAR_TOKENS[i])
+		// operators and punctuation
+		std::size_t op_len;
+		TokType op = match_op(buf + index, op_len);
+		if (op != TOK_EOF)
 		{
-			if (cur == CHAR_TOKENS[i])
-			{
-				Token out(static_cast<TokType>(OP_LT + i), line, col, 1);
-				count(1);
-				return out;
-			}
-
-			++i;
+			Token out(op, buf_pos + index, op_len);
+			index += op_len;
+			return out;
 		}
 
 		// check for string constant
 		if (cur == '\"')
 		{
-			int esc_count = 0;
-			int end = index;
+			std::size_t end = index;
 			char prev = cur;
 
 			do {
 				prev = cur;
 				cur = buf[++end];
-
-				if (cur == '\\') ++esc_count;
 			// \"([^\"\\\n]|\\.)*\"
 			} while (cur && (prev == '\\' || cur != '\"') && cur != '\n');
 
-			// reached EOF
+			// reached EOF, or the end of the window
 			if (!cur)
+			{
+				if (end == visible && refill())
+					continue;
+
 				lex_err("Unterminated string");
+			}
 			if (cur == '\n')
 				lex_err("Missing closing quote");
 			
-			int buf_len = end - index - esc_count;
-			int len = end - index + 1;
-			std::string str_buf;
-			str_buf.reserve(buf_len);
-
-			int buf_idx = 0;
-			// start at index + 1 to skip first quote
-			for (int i = index + 1; i < end; ++i)
-			{
-				if (buf[i] == '\\')
-					str_buf[buf_idx++] = esc_code(buf[++i]);
-				else
-					str_buf[buf_idx++] = buf[i];
-			}
+			if (end - index + 1 > MAX_TOKEN_LEN)
+				lex_err("String constant is too long");
 
-			Token out(STR_CONSTANT, line, col, len);
-			out.val = str_buf;
-			count(len);
+			// text includes the quotes, escapes are left as written
+			Token out(STR_CONSTANT, buf_pos + index, end - index + 1);
+			index += out.len;
 			return out;
 		}
 
-		// try for a identifier
-		if (std::isalpha(cur) || cur == '_')
+		// the rest of the line is read by the preprocessor
+		if (cur == '#' && !directive && first_on_line(index))
 		{
-			int end = index;
-			do
-				cur = buf[++end];
-			while (std::isalnum(buf[end]) || buf[end] == '_');
-
-			int len = end - index;
-
-			Token out(IDENTIFIER, line, col, len);
-			out.val = std::string(buf + index, len);
-			count(len);
-			return out;
+			directive = true;
+			return Token(PP_HASH, buf_pos + index++, 1);
 		}
 
 		std::string s("Invalid character \'");
@@ -396,123 +684,422 @@ Token Lexer::next()
 	}
 }
 
-// assumes that there are no newlines between index and index + count
-int Lexer::count(int count)
+void Lexer::blockcomment()
 {
-	index += count;
-	col += count;
+	// skip the "/*"
+	index += 2;
+	// if the char before index is a '*' in the comment
+	bool star = false;
 
-	char cur = buf[index];
-
-	if (cur == '\n')
+	for (;;)
 	{
-		col = 1;
+		const char *ptr = find_char(buf + index, '/');
+
+		if (ptr > buf + index)
+			star = ptr[-1] == '*';
 
-		while (cur == '\n')
+		if (!*ptr)
 		{
-			cur = buf[++index];
-			++line;
+			// drop the part of the comment read so far and keep going
+			index = ptr - buf;
+			if (index == visible && refill())
+				continue;
+
+			// no terminator, reaches end of file
+			lex_err("Unterminated comment");
 		}
-	}
 
-	if (cur == '\t')
-		// 4 is the only respectable tab size
-		col += 4 - (col & 0b11);
+		// found ending, +1 to move past '/'
+		if (star)
+		{
+			index = ptr + 1 - buf;
+			return;
+		}
+		else if (ptr[1] == '*')
+			lex_err("Unterminated comment");
 
-	return index;
+		index = ptr + 1 - buf;
+		star = false;
+	}
 }
 
-// kinda scuffed method of finding if keywords arent bordering each other
-bool Lexer::keyword(const char *keyword)
+void Lexer::skip_text()
 {
-	bool is_alnum = std::isalnum(*keyword);
-	// if prev char is num or alpha
-	if (is_alnum && index > 0 && std::isalnum(buf[index - 1]))
-		return false;
+	bool line = first_on_line(index);
 
-	const char *buf_ptr = buf + index;
-
-	while (*keyword && *buf_ptr)
+	for (;;)
 	{
-		if (*keyword++ != *buf_ptr++)
-			return false;
+		char cur = buf[index];
+
+		if (cur == '\0')
+		{
+			if (index == visible && refill())
+				continue;
+
+			// the preprocessor reports the unterminated #if
+			return;
+		}
+
+		if (cur == '#' && line)
+			return;
+
+		if (cur == '/' && buf[index + 1] == '*')
+		{
+			blockcomment();
+			continue;
+		}
+
+		if (cur == '/' && buf[index + 1] == '/')
+		{
+			do
+				index = find_char(buf + index, '\n') - buf;
+			while (index == visible && refill());
+
+			continue;
+		}
+
+		// a continued line doesn't start a new one
+		if (cur == '\\' && buf[index + 1] == '\n')
+		{
+			index += 2;
+			continue;
+		}
+
+		if (cur == '\n')
+			line = true;
+		else if (!is_space(cur))
+			line = false;
+
+		++index;
 	}
+}
+
+void Lexer::skip_group()
+{
+	skip_text();
 
-	// if char after is num or alpha
-	if (is_alnum && *buf_ptr && std::isalnum(*buf_ptr))
+	// drop the pre-lexed tokens of the group
+	while (cur_chunk < chunks.size())
 	{
-		return false;
+		Chunk &c = chunks[cur_chunk];
+
+		while (c.fixed_i < c.fixed.size() && c.fixed[c.fixed_i].offset < index)
+			++c.fixed_i;
+		if (c.fixed_i < c.fixed.size())
+			return;
+
+		while (c.from < c.toks.size() && c.toks[c.from].offset < index)
+			++c.from;
+		if (c.from < c.toks.size())
+			return;
+
+		// the chunk stopped at an error inside the group, lex the rest
+		// of the file from here on
+		if (c.error)
+		{
+			chunks.clear();
+			directive = false;
+			return;
+		}
+
+		std::vector<Token>().swap(c.toks);
+		std::vector<Token>().swap(c.fixed);
+		++cur_chunk;
 	}
+}
 
-	return true;
+void Lexer::seek(std::size_t offset)
+{
+	// pre-lexed tokens only come out in order
+	chunks.clear();
+	index = offset;
+	directive = false;
 }
 
-void Lexer::blockcomment()
+void Lexer::lex_err(const std::string &msg)
 {
-	// 2 is for the /* to start the comment
-	const char *ptr = buf + index + 3;
-	char prev = *ptr;
-	char cur = *ptr;
+	// let stitch decide if this is a real error
+	if (worker)
+		throw LexAbort();
+
+	err_at(msg, pos(buf_pos + index));
+}
 
-	int lines = 0;
-	// number of columns after last newline
-	int col_count = 1;
+// -------- parallel lexing -------- //
+
+void Lexer::prelex()
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	std::size_t n = threads * 4;
 
-	while (cur)
+	// split after newlines
+	std::size_t start = 0;
+	for (std::size_t i = 1; start <= visible; ++i)
 	{
-		++col_count;
+		// last chunk includes the EOF token at visible
+		std::size_t end = visible + 1;
+		if (i < n)
+			end = std::min<std::size_t>(end, find_char(buf + visible * i / n, '\n') + 1 - buf);
 
-		if (cur == '\n')
+		if (end <= start)
+			continue;
+
+		chunks.push_back(Chunk());
+		chunks.back().start = start;
+		chunks.back().end = end;
+		start = end;
+	}
+
+	std::atomic<std::size_t> next_chunk(0);
+	std::vector<std::thread> pool;
+
+	for (unsigned i = 0; i < threads; ++i)
+		pool.emplace_back([this, &next_chunk]() {
+			for (std::size_t c; (c = next_chunk++) < chunks.size(); )
+				lex_chunk(chunks[c]);
+		});
+
+	for (std::thread &t : pool)
+		t.join();
+
+	stitch();
+}
+
+void Lexer::lex_chunk(Chunk &c) const
+{
+	Lexer w(*this, c.start);
+	std::size_t before = c.start;
+
+	c.failed = false;
+
+	try
+	{
+		for (;;)
 		{
-			++lines;
-			col_count = 1;
+			before = w.index;
+			Token t = w.lex();
+
+			// belongs to the next chunk
+			if (t.offset >= c.end)
+			{
+				c.stop = before;
+				return;
+			}
+
+			c.toks.push_back(t);
+
+			if (t.type == TOK_EOF)
+			{
+				c.stop = t.offset;
+				return;
+			}
 		}
-		// found ending
-		else if (prev == '*' && cur == '/')
-		{
-			//  +1 to move past '/'
-			count(ptr - (buf + index) + 1);
+	}
+	catch (LexAbort &)
+	{
+		c.stop = before;
+		c.directive = w.directive;
+		c.failed = true;
+	}
+}
+
+void Lexer::stitch()
+{
+	// where the true token stream is at
+	std::size_t at = 0;
+
+	for (std::size_t i = 0; i < chunks.size(); ++i)
+	{
+		Chunk &c = chunks[i];
+		c.from = c.toks.size();
+		c.fixed_i = 0;
+		c.error = false;
+
+		// lex from at until a token lines up with one from the chunk
+		Lexer w(*this, at);
+		std::size_t before = at;
 
-			if (lines != 0)
+		try
+		{
+			for (;;)
 			{
-				col = col_count;
-				line += lines;
+				before = w.index;
+				Token t = w.lex();
+
+				if (t.offset >= c.end)
+				{
+					at = before;
+					break;
+				}
+
+				auto it = std::lower_bound(c.toks.begin(), c.toks.end(), t.offset,
+					[](const Token &a, std::size_t off) { return a.offset < off; });
+
+				// a PP_EOL at the end of the file has the same offset as the EOF
+				if (t.type == TOK_EOF && it != c.toks.end() && it->type == PP_EOL)
+					++it;
+
+				// the first token on a line can't be inside a directive, so
+				// from there on the chunk is in the same state as w
+				if (it != c.toks.end() && it->offset == t.offset && it->type == t.type
+					&& (t.type == TOK_EOF || w.first_on_line(t.offset)))
+				{
+					c.from = it - c.toks.begin();
+					at = c.stop;
+					c.error = c.failed;
+					break;
+				}
+
+				c.fixed.push_back(t);
+
+				if (t.type == TOK_EOF)
+					break;
 			}
+		}
+		catch (LexAbort &)
+		{
+			at = before;
+			c.directive = w.directive;
+			c.error = true;
+		}
 
-			return;
+		// fetch lexes again from here to report it
+		if (c.error)
+		{
+			c.stop = at;
+			chunks.resize(i + 1);
+			break;
+		}
+	}
+}
+
+Token Lexer::fetch()
+{
+	while (cur_chunk < chunks.size())
+	{
+		Chunk &c = chunks[cur_chunk];
+		Token t;
+
+		if (c.fixed_i < c.fixed.size())
+			t = c.fixed[c.fixed_i++];
+		else if (c.from < c.toks.size())
+			t = c.toks[c.from++];
+		else if (c.error)
+		{
+			index = c.stop;
+			directive = c.directive;
+			return lex();
+		}
+		else
+		{
+			std::vector<Token>().swap(c.toks);
+			std::vector<Token>().swap(c.fixed);
+			++cur_chunk;
+			continue;
 		}
-		else if (prev == '/' && cur == '*')
-			lex_err("Unterminated comment");
 
-		// get char and go to next
-		prev = *ptr++;
-		cur = *ptr;
+		if (t.type == IDENTIFIER)
+			t.name = intern(text(t));
+
+		// for the positions in lex_err
+		index = t.offset + t.len;
+		return last = t;
 	}
 
-	// no terminator, reaches end of file
-	lex_err("Unterminated comment");
+	// EOF over and over
+	return last;
 }
 
-void Lexer::lex_err(const std::string &msg)
+void Lexer::scan_lines() const
 {
-	std::cerr << msg
-			  << " at line " << line
-			  << ", col " << col
-			  << '\n';
+	const char *p = buf + (lines_scanned - buf_pos);
+	std::size_t line = lines.back().line;
+
+	for (p = find_char(p, '\n'); *p; p = find_char(p + 1, '\n'))
+		lines.push_back({ buf_pos + (p + 1 - buf), ++line });
 
-	exit(1);
+	lines_scanned = buf_pos + visible;
 }
 
-Token Lexer::peek(unsigned lookahead)
+std::size_t Lexer::line_of(std::size_t offset) const
 {
-	// token doesn't exist in buffer
-	if (lookahead >= tok_buf.size())
+	return std::upper_bound(lines.begin(), lines.end(), offset,
+		[](std::size_t off, const LineStart &l) { return off < l.start; }) - lines.begin() - 1;
+}
+
+void Lexer::trim_lines()
+{
+	if (fd < 0)
+		return;
+
+	// tokens from released to lexed_to can still be asked about. the
+	// lines after that and before the window only have spaces and
+	// comments on them
+	std::size_t from = line_of(released);
+	std::size_t to = line_of(std::max(released, lexed_to)) + 1;
+	std::size_t cur = std::max(to, line_of(buf_pos + index));
+
+	lines.erase(lines.begin() + to, lines.begin() + cur);
+	lines.erase(lines.begin(), lines.begin() + from);
+}
+
+void Lexer::pin(std::size_t offset)
+{
+	// mapped files keep all of their lines
+	if (fd < 0)
+		return;
+
+	scan_lines();
+
+	const LineStart &l = lines[line_of(offset)];
+	if (pinned.empty() || pinned.back().start != l.start)
+		pinned.push_back(l);
+}
+
+SrcPos Lexer::pos(std::size_t offset) const
+{
+	// for a mapped file this only happens the first time
+	scan_lines();
+
+	// lines before the first one kept can only be pinned
+	const std::vector<LineStart> &in = offset >= lines[0].start ? lines : pinned;
+	auto it = std::upper_bound(in.begin(), in.end(), offset,
+		[](std::size_t off, const LineStart &l) { return off < l.start; });
+
+	// released without a pin, the position is gone
+	if (it == in.begin())
+		return { 0, 0, name };
+
+	std::size_t line = (it - 1)->line;
+	std::size_t start = (it - 1)->start;
+
+	// the start of the line was already dropped from a streamed input
+	if (start < buf_pos)
+		return { line, offset - start + 1, name };
+
+	// 4 is the only respectable tab size
+	std::size_t col = 1;
+	for (const char *p = buf + (start - buf_pos); ; ++p)
 	{
-		for (unsigned i = tok_buf.size(); i < lookahead; ++i)
-			tok_buf.push_back(next());
+		if (*p == '\t')
+			col += 4 - (col & 0b11);
+		if (p == buf + (offset - buf_pos))
+			break;
+		++col;
 	}
 
-	return tok_buf.at(lookahead - 1);
+	return { line, col, name };
+}
+
+bool Lexer::first_on_line(std::size_t i) const
+{
+	while (i > 0 && buf[i - 1] != '\n' && is_space(buf[i - 1]))
+		--i;
+
+	if (i > 0)
+		return buf[i - 1] == '\n';
+
+	return buf_pos == 0 || dropped == '\n';
 }
 
 const char *Lexer::getname(TokType t)
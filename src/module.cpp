@@ -0,0 +1,190 @@
+#include <module.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <codegen.hpp>
+#include <scope.hpp>
+#include <types.hpp>
+#include <err.hpp>
+
+// bump when the layout of anything below changes
+const std::uint32_t MODULE_VERSION = 3;
+const char MODULE_MAGIC[4] = { 'c', 'c', 'm', '\0' };
+
+struct ModHeader
+{
+	char magic[4];
+	std::uint32_t version;
+	std::uint32_t sym_count;
+	std::uint32_t type_count;
+	std::uint32_t param_count;
+	std::uint32_t str_len;
+};
+
+// name is an offset into the strings after the records, type is a handle
+// in the module's own type table, see TypeRec. the param types of a
+// function are val handles from params on, in the table after the syms
+struct ModSym
+{
+	std::uint32_t name, len;
+	std::uint8_t vtype, pad[3];
+	std::uint32_t type;
+	std::int32_t val;
+	std::uint32_t params;
+};
+
+static_assert(sizeof(ModHeader) == 24 && sizeof(ModSym) == 24 && sizeof(TypeRec) == 12,
+	"module records should be packed");
+
+void save_module(const std::string &filename)
+{
+	const std::vector<int> &syms = Scope::s(Scope::GLOBAL)->syms;
+
+	std::vector<ModSym> recs;
+	std::vector<Type> params;
+	std::string strs;
+	// each name is only stored once
+	std::unordered_map<Name, std::uint32_t> str_off;
+
+	// written before the syms so that they can be checked against it
+	std::vector<TypeRec> types = save_types();
+
+	for (int id : syms)
+	{
+		const Sym &s = Scope::sym(Scope::GLOBAL, id);
+		std::string_view name = name_str(s.name);
+
+		auto it = str_off.find(s.name);
+		if (it == str_off.end())
+		{
+			it = str_off.emplace(s.name, strs.size()).first;
+			strs += name;
+		}
+
+		ModSym r = {};
+		r.name = it->second;
+		r.len = name.size();
+		r.vtype = s.vtype;
+		r.type = s.type;
+		r.val = s.val;
+
+		if (s.vtype == V_FUNC)
+		{
+			r.params = params.size();
+			for (int i = 0; i < s.val; ++i)
+				params.push_back(Scope::param(s, i));
+		}
+
+		recs.push_back(r);
+	}
+
+	ModHeader h = {};
+	std::memcpy(h.magic, MODULE_MAGIC, sizeof(h.magic));
+	h.version = MODULE_VERSION;
+	h.sym_count = recs.size();
+	h.type_count = types.size();
+	h.param_count = params.size();
+	h.str_len = strs.size();
+
+	std::ofstream f(filename, std::ios::binary);
+	if (!f)
+		err("Module file failed to open");
+
+	f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+	f.write(reinterpret_cast<const char *>(types.data()), types.size() * sizeof(TypeRec));
+	f.write(reinterpret_cast<const char *>(recs.data()), recs.size() * sizeof(ModSym));
+	f.write(reinterpret_cast<const char *>(params.data()), params.size() * sizeof(Type));
+	f.write(strs.data(), strs.size());
+
+	if (!f)
+		err("Module file could not be written");
+}
+
+void load_module(const std::string &filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		err("Invalid module file specified");
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		err("Module file could not be read!");
+
+	std::size_t len = st.st_size;
+	if (len < sizeof(ModHeader))
+		err("Invalid module file " + filename);
+
+	void *base = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED)
+		err("Module file could not be read!");
+
+	const char *data = static_cast<const char *>(base);
+	const ModHeader *h = reinterpret_cast<const ModHeader *>(data);
+
+	if (std::memcmp(h->magic, MODULE_MAGIC, sizeof(h->magic)) || h->version != MODULE_VERSION
+		|| len != sizeof(ModHeader) + std::size_t(h->type_count) * sizeof(TypeRec)
+			+ std::size_t(h->sym_count) * sizeof(ModSym) + std::size_t(h->param_count) * sizeof(Type)
+			+ h->str_len)
+		err("Invalid module file " + filename);
+
+	const TypeRec *types = reinterpret_cast<const TypeRec *>(data + sizeof(ModHeader));
+	const ModSym *recs = reinterpret_cast<const ModSym *>(types + h->type_count);
+
+	// module handles to ours
+	std::vector<Type> type_map;
+	if (!load_types(types, h->type_count, type_map))
+		err("Invalid module file " + filename);
+	const Type *params = reinterpret_cast<const Type *>(recs + h->sym_count);
+	const char *strs = reinterpret_cast<const char *>(params + h->param_count);
+
+	Scope *globl = Scope::s(Scope::GLOBAL);
+
+	for (std::uint32_t i = 0; i < h->sym_count; ++i)
+	{
+		const ModSym &r = recs[i];
+
+		// only globals and functions are declared at file scope, and
+		// val is either assigned or the param count
+		bool val_ok = r.vtype == V_GLOBL ? r.val == 0 || r.val == 1
+			: r.vtype == V_FUNC && r.val >= 0 && r.val <= MAX_PARAMS;
+
+		if (std::size_t(r.name) + r.len > h->str_len || !val_ok || r.type >= type_map.size()
+			|| (r.vtype == V_FUNC && std::size_t(r.params) + r.val > h->param_count))
+			err("Invalid module file " + filename);
+
+		Sym sym(static_cast<VarType>(r.vtype), type_map[r.type],
+			intern(std::string_view(strs + r.name, r.len)), r.val);
+
+		if (r.vtype == V_FUNC)
+		{
+			Type types[MAX_PARAMS];
+			for (int i = 0; i < r.val; ++i)
+			{
+				if (params[r.params + i] >= type_map.size())
+					err("Invalid module file " + filename);
+				types[i] = type_map[params[r.params + i]];
+			}
+
+			sym.params = Scope::add_params(types, r.val);
+		}
+
+		int id = globl->add(sym);
+
+		// same as parsing the declaration, storage is common to every file
+		if (r.vtype == V_GLOBL && !r.val)
+			add_globl(Scope::sym(Scope::GLOBAL, id), AST());
+	}
+
+	munmap(base, len);
+}
@@ -1,14 +1,73 @@
 #include <parser.hpp>
 
+#include <algorithm>
+
 #include <codegen.hpp>
 #include <types.hpp>
 #include <err.hpp>
 
+// -------- ast store -------- //
+
+ASTStore asts;
+
+AST AST::make(NodeType type, Type p, AST lhs, AST mid, AST rhs)
+{
+	AST out(asts.type.size());
+
+	asts.type.push_back(type);
+	asts.ptype.push_back(p);
+	asts.lhs.push_back(lhs);
+	asts.mid.push_back(mid);
+	asts.rhs.push_back(rhs);
+	asts.val.push_back(0);
+	asts.scope_id.push_back(0);
+
+	return out;
+}
+
+void ASTStore::rewind(const Mark &m)
+{
+	type.resize(m.nodes);
+	ptype.resize(m.nodes);
+	lhs.resize(m.nodes);
+	mid.resize(m.nodes);
+	rhs.resize(m.nodes);
+	val.resize(m.nodes);
+	scope_id.resize(m.nodes);
+
+	lists.resize(m.lists);
+}
+
+AST AST::make_list(std::size_t start)
+{
+	std::uint32_t count = asts.scratch.size() - start;
+	AST *data = nullptr;
+
+	if (count)
+	{
+		data = static_cast<AST *>(arena.alloc(count * sizeof(AST), alignof(AST)));
+		std::copy(asts.scratch.begin() + start, asts.scratch.end(), data);
+		asts.scratch.resize(start);
+	}
+
+	AST out = make(LIST);
+	out.val() = asts.lists.size();
+	asts.lists.push_back({ data, count });
+
+	return out;
+}
+
 static bool is_type(TokType t)
 {
 	return t == KEY_BOOL || t == KEY_CHAR || t == KEY_INT || t == KEY_FLOAT || t == KEY_VOID || t == KEY_LONG;
 }
 
+// type or qualifier
+static bool is_decl(TokType t)
+{
+	return is_type(t) || t == KEY_CONST;
+}
+
 static bool is_assign(TokType t)
 {
 	return t == OP_SET || t == OP_ADD_SET || t == OP_SUB_SET || t == OP_MUL_SET
@@ -18,68 +77,66 @@ static bool is_assign(TokType t)
 
 // -------- grammars -------- //
 
-// binop | assign
-AST *Parser::expr()
-{
-	TokType two_ahead = l.peek(2).type;
-	if (is_assign(two_ahead))
-	 	return assign();
-	else
-		return cond();
-}
-
 // [ expr ]
-AST *Parser::exp_option()
+AST Parser::exp_option()
 {
 	if (l.peek().type == SEMI || l.peek().type == RPAREN)
-		return new AST(NONE);
+		return AST::make(NONE);
 	else
 		return expr();
 }
 
 // 'return' expr ';' | if  | compound | exp_option ';' | KEY_BREAK ';' | KEY_CONT ';' | for | while | do
-AST *Parser::stmt()
+//
+// statements with statements in them wait on stmts until those are
+// parsed, like operators in expr, so nesting is only limited by memory
+AST Parser::stmt()
 {
-	AST *out;
+	std::size_t base = stmts.size();
+	return close_stmts(base, open_stmt());
+}
+
+// a statement with none in it, or no node if one was opened on stmts
+AST Parser::open_stmt()
+{
+	AST out;
 	bool semi = true;
 
+	// errors are only given for tokens of the statement being parsed
+	l.release();
+
 	switch (l.peek().type) {
 		case KEY_RETURN:
 			l.eat(KEY_RETURN);
-			out = new AST(RET, INT, exp_option());
+			out = AST::make(RET, INT, exp_option());
 			break;
 		case KEY_IF:
-			out = if_stmt();
-			semi = false;
-			break;
+			if_stmt();
+			return AST();
 		case KEY_FOR:
-			out = for_stmt();
-			semi = false;
-			break;
+			for_stmt();
+			return AST();
 		case KEY_WHILE:
-			out = while_stmt();
-			semi = false;
-			break;
+			while_stmt();
+			return AST();
 		case KEY_DO:
-			out = do_stmt();
-			semi = false;
-			break;
+			do_stmt();
+			return AST();
 		case KEY_BREAK:
-			if (!in_loop)
-				err_tok("Break cannot appear outside of loop body", l.peek());
+			if (!loops)
+				err_tok("Break cannot appear outside of loop body", l, l.peek());
 			l.eat(KEY_BREAK);
-			out = new AST(BREAK);
+			out = AST::make(BREAK);
 			break;
 		case KEY_CONT:
-			if (!in_loop)
-				err_tok("Continue cannot appear outside of loop body", l.peek());
+			if (!loops)
+				err_tok("Continue cannot appear outside of loop body", l, l.peek());
 			l.eat(KEY_CONT);
-			out = new AST(CONT);
+			out = AST::make(CONT);
 			break;
 		case LBRAC:
-			out = compound();
-			semi = false;
-			break;
+			block(true);
+			return AST();
 		case RPAREN: 
 			out = exp_option();
 			semi = false;
@@ -95,32 +152,162 @@ AST *Parser::stmt()
 	return out;
 }
 
+// gives kid to the statement on top of stmts, returns that statement if
+// it's done and no node if it's waiting for another one. kid is no node
+// right after the statement was opened
+AST Parser::close_stmt(AST kid)
+{
+	PendingStmt &top = stmts.back();
+	AST out = top.out;
+
+	switch (top.kind) {
+		case PendingStmt::BLOCK: {
+			if (kid)
+				AST::list_add(kid);
+
+			// decls have no statements in them
+			Token tok = l.peek();
+			while (is_decl(tok.type))
+			{
+				l.release();
+				AST::list_add(decl());
+				tok = l.peek();
+			}
+
+			if (!tok.type)
+				err_tok("Unterminated function body", l, tok);
+			else if (tok.type != RBRAC)
+				return AST();
+
+			l.eat(RBRAC);
+
+			out = AST::make_list(top.start);
+			out.scope_id() = cur_scope;
+
+			// aka not a function
+			if (top.flag)
+				Scope::s(cur_scope)->size = stk_size;
+
+			// reset scope
+			cur_scope = Scope::s(cur_scope)->parent_id;
+			break;
+		}
+
+		case PendingStmt::IF:
+			if (!kid)
+				return AST();
+
+			if (top.flag)
+			{
+				top.cur.rhs() = kid;
+				break;
+			}
+
+			top.cur.mid() = kid;
+
+			if (l.peek().type != KEY_ELSE)
+				break;
+
+			l.eat(KEY_ELSE);
+
+			if (l.peek().type != KEY_IF)
+			{
+				top.flag = true;
+				return AST();
+			}
+
+			top.cur.rhs() = AST::make(IF);
+			top.cur = top.cur.rhs();
+			if_cond(top.cur);
+			return AST();
+
+		case PendingStmt::FOR:
+			if (!kid)
+				return AST();
+
+			top.cur.lhs() = kid;
+
+			if (top.flag)
+				cur_scope = Scope::s(cur_scope)->parent_id;
+
+			--loops;
+			break;
+
+		case PendingStmt::WHILE:
+			if (!kid)
+				return AST();
+
+			out.rhs() = kid;
+			--loops;
+			break;
+
+		case PendingStmt::DO:
+			if (!kid)
+				return AST();
+
+			out.rhs() = kid;
+			--loops;
+
+			l.eat(KEY_WHILE);
+			l.eat(LPAREN);
+
+			out.lhs() = expr();
+
+			l.eat(RPAREN);
+			l.eat(SEMI);
+			break;
+	}
+
+	stmts.pop_back();
+	return out;
+}
+
+// hands finished statements to the ones waiting on stmts above base
+// until they are all done. out is the statement that was parsed last,
+// if any
+AST Parser::close_stmts(std::size_t base, AST out)
+{
+	for (;;)
+	{
+		while (stmts.size() > base)
+		{
+			out = close_stmt(out);
+			if (!out)
+				break;
+		}
+
+		if (stmts.size() == base)
+			return out;
+
+		out = open_stmt();
+	}
+}
+
 // params = [ type IDENTIFIER [ ',' params ] ]
 // type IDENTIFIER '(' params ')' ( '{' { stmt | decl } '}' | ';' )
 // AST - lhs = symtab entry, mid = params, rhs = block
-AST *Parser::func()
+AST Parser::func()
 {
-	AST *out = new AST(FUNC);
-	out->mid = new AST(LIST);
+	AST out = AST::make(FUNC);
 
 	Token tok = l.peek();
 	TokType t = tok.type;
 	if (!is_type(t))
-		err_tok("Expected function return type", tok);
+		err_tok("Expected function return type", l, tok);
 
 	l.eat(t);
-	PrimType p = Parser::asptype(t);
+	Type p = Parser::asptype(t);
 
 	// symbol entry //
 
-	std::string name = std::get<std::string>(l.eat(IDENTIFIER).val);
+	Name name = l.eat(IDENTIFIER).name;
 
 	Scope *globl = Scope::s(Scope::GLOBAL);
-	bool prev_declared = globl->in_scope(name);
+	int prev = globl->find_local(name);
 
 	// add to sym tab
-	globl->syms.push_back(Sym(V_FUNC, p, name, 0));
-	out->lhs = new AST(p, globl->syms.size() - 1, Scope::GLOBAL);
+	int fn = globl->add(Sym(V_FUNC, p, name, 0));
+	out.lhs() = AST::make_var(p, fn, Scope::GLOBAL);
 
 	l.eat(LPAREN);
 	
@@ -131,31 +318,35 @@ AST *Parser::func()
 	int param_count = 0;
 	cur_scope = Scope::new_scope(cur_scope);
 	Scope *cur = Scope::s(cur_scope);
-	AST *bottom = out->mid;
+	std::size_t params = AST::list_start();
+	Type param_types[MAX_PARAMS];
 
 	tok = l.peek();
 	t = tok.type;
 	while (t != RPAREN)
 	{
 		if (!is_type(t))
-			err_tok("Expected function param type", tok);
+			err_tok("Expected function param type", l, tok);
+		if (param_count == MAX_PARAMS)
+			err_tok("Too many function params", l, tok);
 		
 		l.eat(t);
-		PrimType p = Parser::asptype(t);
+		Type p = Parser::asptype(t);
 
 		// get param name
+		int param;
 		if (param_count < ARG_COUNT)
-			cur->syms.push_back(Sym(V_REG, p,
-				std::get<std::string>(l.eat(IDENTIFIER).val),
+			param = cur->add(Sym(V_REG, p,
+				l.eat(IDENTIFIER).name,
 				FIRST_ARG + param_count));
 		else
-			cur->syms.push_back(Sym(V_VAR, p,
-				std::get<std::string>(l.eat(IDENTIFIER).val),
+			param = cur->add(Sym(V_VAR, p,
+				l.eat(IDENTIFIER).name,
 				p_offset += 8));
 
-		bottom = AST::append(bottom, new AST(p, cur->syms.size() - 1, cur_scope), LIST);
+		AST::list_add(AST::make_var(p, param, cur_scope));
 
-		++param_count;
+		param_types[param_count++] = p;
 
 		if (l.peek().type != RPAREN)
 			l.eat(COMMA);
@@ -165,24 +356,30 @@ AST *Parser::func()
 	}
 
 	if (!t)
-		err_tok("Unclosed parentheses in function definition", tok);
-	
-	// set value to param count
-	globl->syms.back().val = param_count;
+		err_tok("Unclosed parentheses in function definition", l, tok);
 
-	if (prev_declared)
+	out.mid() = AST::make_list(params);
+	
+	// set value to param count, calls convert their args to the types
+	Sym &sym = Scope::sym(Scope::GLOBAL, fn);
+	sym.val = param_count;
+	sym.params = Scope::add_params(param_types, param_count);
+
+	// every declaration was checked against the first one, so checking
+	// against it is enough
+	if (prev >= 0)
 	{
-		for (Sym &s : globl->syms)
-			// if a symbol is found with the same name
-			if (s.name == name)
-			{
-				// if the symbol is a function
-				// if the function has different num of params than this function
-				if (s.vtype == V_FUNC && s.val != param_count)
-					err_tok("Function parameter count does not match with previous declaration", tok);
-				else if (s.vtype == V_GLOBL)
-					err_tok("Redefition of variable " + name, tok);
-			}
+		const Sym &s = Scope::sym(Scope::GLOBAL, prev);
+
+		// if the function has different num of params than this function
+		if (s.vtype == V_FUNC && s.val != param_count)
+			err_tok("Function parameter count does not match with previous declaration", l, tok);
+		else if (s.vtype == V_GLOBL)
+			err_tok("Redefition of variable " + std::string(name_str(name)), l, tok);
+
+		for (int i = 0; i < param_count; ++i)
+			if (Scope::param(s, i) != param_types[i])
+				err_tok("Function parameter types do not match with previous declaration", l, tok);
 	}
 
 	l.eat(RPAREN);
@@ -196,78 +393,115 @@ AST *Parser::func()
 
 	// scope is reset in compound
 	offset = 0;
-	out->rhs = compound(false);
-	out->val = offset;
+	out.rhs() = compound(false);
+	out.val() = offset;
 
 	return out;
 }
 
-// type *['*'] IDENTIFIER [ '=' expr ] ';'
-AST *Parser::decl()
+// [ const ] type { '*' [ const ] } IDENTIFIER [ '[' INT_CONSTANT ']' ] [ '=' expr ] ';'
+AST Parser::decl()
 {
 	bool globl = cur_scope == Scope::GLOBAL;
 
+	std::uint8_t quals = 0;
+	if (l.peek().type == KEY_CONST)
+	{
+		l.eat(KEY_CONST);
+		quals = Q_CONST;
+	}
+
 	Token tok = l.peek();
 	TokType nxt = tok.type;
-	PrimType type = Parser::asptype(nxt);
 
 	if (!is_type(nxt))
-		err_tok("Expected variable type preceding declaration", tok);
+		err_tok("Expected variable type preceding declaration", l, tok);
 
 	l.eat(nxt);
+	Type type = qualified(Parser::asptype(nxt), quals);
 
 	// pointer
 	while (l.peek().type == OP_MUL)
 	{
-		type = pointer_type(type);
+		type = pointer_to(type);
 		l.eat(OP_MUL);
+
+		if (l.peek().type == KEY_CONST)
+		{
+			l.eat(KEY_CONST);
+			type = qualified(type, Q_CONST);
+		}
 	}
 
 	Token id = l.eat(IDENTIFIER);
 	// check if decl type and id type are the same here
-	std::string name = std::get<std::string>(id.val);
+	Name name = id.name;
 
-	AST *out = new AST(DECL, type, new AST(type, Scope::s(cur_scope)->syms.size(), cur_scope));
+	// array
+	if (l.peek().type == LBRAC_SQ)
+	{
+		l.eat(LBRAC_SQ);
+		Token len = l.eat(INT_CONSTANT);
+		if (len.ival <= 0)
+			err_tok("Array size has to be positive", l, len);
+		if (!array_fits(type, len.ival))
+			err_tok("Array is too large", l, len);
+		l.eat(RBRAC_SQ);
+
+		type = array_of(type, len.ival);
+	}
 
 	bool assigned = l.peek().type == OP_SET;
+	if (assigned && type_info(type).kind == T_ARRAY)
+		err_tok("Array initializers are not supported", l, id);
+
+	Scope *scope = Scope::s(cur_scope);
+	int prev = scope->find_local(name);
 
-	// two calls to a linear search, not good
-	if (Scope::s(cur_scope)->in_scope(name))
+	if (prev >= 0)
 	{
 		if (globl)
 		{
-			Sym &s = Scope::s(cur_scope)->get(name)->get_sym();
+			Sym &s = Scope::sym(cur_scope, prev);
 			if (s.vtype == V_FUNC)
-				err_tok("Redefinition of function " + name, id);
+				err_tok("Redefinition of function " + std::string(name_str(name)), l, id);
 			else if (assigned && s.vtype == V_GLOBL && s.val)
-				err_tok("Redefinition of variable " + name, id);
+				err_tok("Redefinition of variable " + std::string(name_str(name)), l, id);
 		}
 		else
-			err_tok("Redefinition of variable " + name, id);
+			err_tok("Redefinition of variable " + std::string(name_str(name)), l, id);
 	}
 
+	int sym;
 	if (globl)
-		Scope::s(cur_scope)->syms.push_back(Sym(V_GLOBL, Parser::asptype(nxt), name));
+		sym = scope->add(Sym(V_GLOBL, type, name));
 	else
 	{
-		int sz = 1 << p_sizeof(type);
-		Scope::s(cur_scope)->syms.push_back(Sym(V_VAR, Parser::asptype(nxt), name, (offset -= sz)));
+		const TypeInfo &info = type_info(type);
+		if (!info.bytes)
+			err_tok("Variable " + std::string(name_str(name)) + " has incomplete type " + type_name(type), l, id);
+
+		// offset only goes down within a function, so this bounds the frame
+		std::uint32_t sz = info.bytes;
+		if (sz > MAX_OBJECT_BYTES - std::uint32_t(-offset))
+			err_tok("Locals of function are too large", l, id);
+
+		offset -= sz;
+		sym = scope->add(Sym(V_VAR, type, name, offset));
 		stk_size += sz;
 	}
 
+	AST out = AST::make(DECL, type, AST::make_var(type, sym, cur_scope));
+
 	if (assigned)
 	{
 		// use val to store if assigned or not
 		if (globl)
-			Scope::s(cur_scope)->syms.back().val = true;
+			Scope::sym(cur_scope, sym).val = true;
 
-		out->type = DECL_SET;
+		out.type() = DECL_SET;
 		l.eat(OP_SET);
-		out->rhs = expr();
-
-		// hacky fix for setting char to integer constant
-		if (out->lhs->get_sym().type == CHAR && out->rhs->type == INT_CONST)
-			out->rhs->ptype = CHAR;
+		out.rhs() = expr();
 	}
 
 	l.eat(SEMI);
@@ -277,431 +511,439 @@ AST *Parser::decl()
 
 // 'if' '(' expr ')' ( stmt | blk ) [ 'else' ( stmt | blk) ]
 // lhs = cond, mid = if, rhs = else
-AST *Parser::if_stmt()
+// else if ladders are linked up in a loop instead of nesting, see close_stmt
+void Parser::if_stmt()
 {
-	AST *out = new AST(IF);
+	AST out = AST::make(IF);
+	if_cond(out);
 
+	stmts.push_back({ PendingStmt::IF, out, out, 0, false });
+}
+
+// 'if' '(' expr ')', sets the cond of n
+void Parser::if_cond(AST n)
+{
 	l.eat(KEY_IF);
 	l.eat(LPAREN);
 
-	out->lhs = expr();
+	n.lhs() = expr();
 
 	l.eat(RPAREN);
-
-	out->mid = stmt();
-
-	if (l.peek().type == KEY_ELSE)
-	{
-		l.eat(KEY_ELSE);
-
-		out->rhs = stmt();
-	}
-
-	return out;
 }
 
 // KEY_FOR '(' ( exp_option ';' | decl ) exp_option ';' exp_option ')' stmt
-// lhs = init, mid = cond, rhs->lhs = compound, rhs->rhs = post
-AST *Parser::for_stmt()
+// lhs = init, mid = cond, rhs.lhs() = compound, rhs.rhs() = post
+void Parser::for_stmt()
 {
 	l.eat(KEY_FOR);
 	l.eat(LPAREN);
 	
-	AST *out = new AST();
-	AST *child = new AST(FOR);
-	out->rhs = child;
+	AST out = AST::make(NONE);
+	AST child = AST::make(FOR);
+	out.rhs() = child;
 
-	bool declaration = is_type(l.peek().type);
+	bool declaration = is_decl(l.peek().type);
 
-	out->type = declaration ? FOR_DECL : FOR;
+	out.type() = declaration ? FOR_DECL : FOR;
 
 	// parse decl
 	if (declaration)
 	{
 		cur_scope = Scope::new_scope(cur_scope);
-		out->scope_id = cur_scope;
+		out.scope_id() = cur_scope;
 
 		// kinda stupid, saves stack size
 		int tmp = stk_size;
-		out->lhs = decl();
-		out->val = stk_size - tmp;
+		out.lhs() = decl();
+		out.val() = stk_size - tmp;
 		stk_size = tmp;
 	}
 	else
 	{
-		out->lhs = exp_option();
+		out.lhs() = exp_option();
 		l.eat(SEMI);
 	}
 
-	out->mid = exp_option();
+	out.mid() = exp_option();
 	l.eat(SEMI);
-	child->rhs = exp_option();
+	child.rhs() = exp_option();
 	l.eat(RPAREN);
 
-	in_loop = true;
-	child->lhs = stmt();
-
-	if (declaration)
-		cur_scope = Scope::s(cur_scope)->parent_id;
-
-	in_loop = false;
-
-	return out;
+	++loops;
+	stmts.push_back({ PendingStmt::FOR, out, child, 0, declaration });
 }
 
 // KEY_WHILE '(' expr ')' stmt
 // lhs = cond, rhs = blk
-AST *Parser::while_stmt()
+void Parser::while_stmt()
 {
-	AST *out = new AST(WHILE);
+	AST out = AST::make(WHILE);
 
 	l.eat(KEY_WHILE);
 	l.eat(LPAREN);
 
-	out->lhs = expr();
+	out.lhs() = expr();
 
 	l.eat(RPAREN);
 
-	in_loop = true;
-	out->rhs = stmt();
-	in_loop = false;
-
-	return out;
+	++loops;
+	stmts.push_back({ PendingStmt::WHILE, out, AST(), 0, false });
 }
 
 // KEY_DO stmt KEY_WHILE '(' expr ')' ';'
 // lhs = cond, rhs = blk
-AST *Parser::do_stmt()
+void Parser::do_stmt()
 {
-	AST *out = new AST(DO);
+	AST out = AST::make(DO);
 
 	l.eat(KEY_DO);
 
-	in_loop = true;
-	out->rhs = stmt();
-	in_loop = false;
-
-	l.eat(KEY_WHILE);
-	l.eat(LPAREN);
-
-	out->lhs = expr();
-
-	l.eat(RPAREN);
-	l.eat(SEMI);
-
-	return out;
+	++loops;
+	stmts.push_back({ PendingStmt::DO, out, AST(), 0, false });
 }
 
 // '{' { stmt | decl } '}'
-// block stored in lhs, size stored in val
-AST *Parser::compound(bool newscope)
+// list of the block, size stored in its scope
+void Parser::block(bool newscope)
 {
 	stk_size = 0;
 
 	if (newscope)
 		cur_scope = Scope::new_scope(cur_scope);
-	
-	AST *out = new AST(LIST);
-	out->scope_id = cur_scope;
-	AST *bottom = out;
-
-	l.eat(LBRAC);
-
-	Token tok = l.peek();
-	TokType t = tok.type;
-	while (t != RBRAC)
-	{
-		if (is_type(t))
-			bottom = AST::append(bottom, decl(), LIST);
-		else
-			bottom = AST::append(bottom, stmt(), LIST);
-		
-		tok = l.peek();
-		t = tok.type;
-	}
-
-	if (!t)
-		err_tok("Unterminated function body", tok);
 
-	l.eat(RBRAC);
+	std::size_t start = AST::list_start();
 
-	// reset scope
-	cur_scope = Scope::s(cur_scope)->parent_id;
+	l.eat(LBRAC);
 
-	// aka not a function
-	if (newscope)
-		out->val = stk_size;
+	stmts.push_back({ PendingStmt::BLOCK, AST(), AST(), start, newscope });
+}
 
-	return out;
+// a whole block, for function bodies
+AST Parser::compound(bool newscope)
+{
+	std::size_t base = stmts.size();
+	block(newscope);
+	return close_stmts(base, AST());
 }
 
 // -------- expressions -------- //
 
 // IDENTIFIER
-AST *Parser::lval()
+AST Parser::lval()
 {
-	// get the var with the name of the identifier token from the cur scope
-	return Scope::s(cur_scope)->get(std::get<std::string>(l.eat(IDENTIFIER).val));
+	return var(l.eat(IDENTIFIER));
 }
 
-// lval assign expr
-// lhs t rhs
-AST *Parser::assign()
+// the var an identifier refers to from the cur scope
+AST Parser::var(const Token &id)
 {
-	AST *lv = lval();
+	int sym;
+	int scope = Scope::s(cur_scope)->find(id.name, sym);
 
-	Token tok = l.peek();
-	TokType t = tok.type;
-	if (!is_assign(t))
-		err_tok("Expected assignment operator", tok);
-	
-	l.eat(t);
-
-	AST *rhs = expr();
-
-	// hacky fix for setting char to integer constant
-	if (lv->get_sym().type == CHAR && rhs->type == INT_CONST)
-		rhs->ptype = CHAR;
+	if (scope < 0)
+		err_tok("Could not find variable " + std::string(name_str(id.name)), l, id);
 
-	return new AST(Parser::asnode(t), INT, lv, rhs);
+	// scope entry and scope id
+	return AST::make_var(Scope::sym(scope, sym).type, sym, scope);
 }
 
-// -------- binary operations -------- //
-
-#define BINEXP(func, call_func, type_eval, node)                                               \
-	AST *Parser::func()                                                                        \
-	{                                                                                          \
-		AST *out = call_func();                                                                \
-		TokType t = l.peek().type;                                                             \
-                                                                                               \
-		while (type_eval)                                                                      \
-		{                                                                                      \
-			l.eat(t);                                                                          \
-			AST *c = call_func();                                                              \
-			out = new AST(node,                                                                \
-						  (p_sizeof(out->ptype) > p_sizeof(c->ptype)) ? out->ptype : c->ptype, \
-						  out, c);                                                             \
-			t = l.peek().type;                                                                 \
-		}                                                                                      \
-                                                                                               \
-		return out;                                                                            \
-	}
+// node and precedence of every binary operator token, higher binds
+// tighter and 0 is not an operator. all of them are left associative
+struct BinOp { NodeType node; int prec; };
+
+static const struct BinOps {
+	BinOp ops[TOK_COUNT];
 
-#define BINEXP_ASNODE(func, call_func, type_eval)                                              \
-	AST *Parser::func()                                                                        \
-	{                                                                                          \
-		AST *out = call_func();                                                                \
-		TokType t = l.peek().type;                                                             \
-                                                                                               \
-		while (type_eval)                                                                      \
-		{                                                                                      \
-			l.eat(t);                                                                          \
-			AST *c = call_func();                                                              \
-			out = new AST(Parser::asnode(t),                                                   \
-						  (p_sizeof(out->ptype) > p_sizeof(c->ptype)) ? out->ptype : c->ptype, \
-						  out, c);                                                             \
-			t = l.peek().type;                                                                 \
-		}                                                                                      \
-                                                                                               \
-		return out;                                                                            \
+	BinOps() : ops()
+	{
+		set(OP_LOGOR, 1);
+		set(OP_LOGAND, 2);
+		set(OP_OR, 3);
+		set(OP_XOR, 4);
+		ops[OP_AMPER] = { AND, 5 };
+		set(OP_EQ, 6); set(OP_NE, 6);
+		set(OP_LE, 7); set(OP_GE, 7); set(OP_LT, 7); set(OP_GT, 7);
+		set(OP_SHL, 8); set(OP_SHR, 8);
+		set(OP_ADD, 9); set(OP_SUB, 9);
+		set(OP_MUL, 10); set(OP_DIV, 10); set(OP_MOD, 10);
 	}
 
-// op_or [ '?' expr ':' cond ]
-AST *Parser::cond()
+	void set(TokType t, int prec) { ops[t] = { Parser::asnode(t), prec }; }
+} BINOPS;
+
+// primary    = IDENTIFIER | call | INT_CONSTANT | CHAR_CONSTANT | '(' expr ')'
+// postfix    = primary [ OP_INC | OP_DEC ]
+// unop       = postfix | ( OP_INC | OP_DEC | '&' | '*' ) lval | ( '!' | '~' | '-' ) unop
+// binary     = unop { binop unop }, by the precedences in BINOPS
+// cond       = binary [ '?' expr ':' cond ]
+// expr       = cond [ assign expr ], where the cond has to be an lval
+// call       = IDENTIFIER '(' [ expr { ',' expr } ] ')'
+//
+// parsed without recursion: operators wait on ops until their operands
+// are on vals, and so do open parentheses, calls and conditions, so
+// nesting is only limited by memory
+AST Parser::expr()
 {
-	AST *c = op_or();
+	std::size_t base = ops.size();
+	bool operand = true;
 
-	if (l.peek().type == OP_COND)
+	for (;;)
 	{
-		l.eat(OP_COND);
+		Token tok = l.peek();
+		TokType t = tok.type;
 
-		AST *t = expr();
+		if (operand)
+		{
+			switch (t) {
+				// these take an lval, not an operand
+				case OP_INC:
+				case OP_DEC:
+				case OP_AMPER:
+				case OP_MUL: {
+					NodeType n = t == OP_INC ? UN_INC : t == OP_DEC ? UN_DEC : t == OP_AMPER ? REF : PTR;
+					l.eat(t);
+					vals.push_back(AST::make(n, INT, lval()));
+					operand = false;
+					continue;
+				}
+
+				case OP_SUB:
+				case OP_LOGNOT:
+				case OP_NOT:
+					l.eat(t);
+					ops.push_back({ PendingOp::PREFIX, t == OP_SUB ? NEG : Parser::asnode(t), 0 });
+					continue;
+
+				case LPAREN:
+					l.eat(t);
+					ops.push_back({ PendingOp::PAREN, NONE, 0 });
+					continue;
+
+				case INT_CONSTANT:
+					l.eat(t);
+					vals.push_back(AST::make(INT_CONST, INT, tok.ival));
+					break;
+				case CHAR_CONSTANT:
+					l.eat(t);
+					vals.push_back(AST::make(INT_CONST, CHAR, tok.ival));
+					break;
+
+				case IDENTIFIER:
+					if (l.peek(2).type == LPAREN)
+					{
+						open_call();
+
+						if (l.peek().type != RPAREN)
+							continue;
+
+						close_call();
+					}
+					else
+						vals.push_back(lval());
+					break;
+
+				default:
+					err_tok(std::string("Invalid expression ") + l.getname(t), l, tok);
+			}
 
-		l.eat(OP_COLON);
+			postfix();
+			operand = false;
+			continue;
+		}
 
-		return new AST(COND, INT, c, t, cond());
-	}
-	else
-		return c;
-}
+		const BinOp &op = BINOPS.ops[t];
 
-// op_and { '||' op_and }
-BINEXP(op_or, op_and, t == OP_LOGOR, LOGOR)
+		if (op.prec)
+		{
+			while (ops.size() > base && (ops.back().kind == PendingOp::PREFIX
+				|| (ops.back().kind == PendingOp::BINARY && ops.back().prec >= op.prec)))
+				reduce();
 
-// bitwise_or { '&&' bitwise_or }
-BINEXP(op_and, bitwise_or, t == OP_LOGAND, LOGAND)
+			l.eat(t);
+			ops.push_back({ PendingOp::BINARY, op.node, op.prec });
+		}
+		else if (is_assign(t))
+		{
+			// assignments are right associative and the lhs of one is never
+			// the else of a condition
+			while (ops.size() > base && (ops.back().kind == PendingOp::PREFIX
+				|| ops.back().kind == PendingOp::BINARY || ops.back().kind == PendingOp::COLON))
+				reduce();
+
+			AST lv = vals.back();
+			if (lv.type() != VAR || lv.get_sym().vtype == V_FUNC)
+				err_tok("Expected lvalue before assignment", l, tok);
+
+			l.eat(t);
+			ops.push_back({ PendingOp::ASSIGN, Parser::asnode(t), 0 });
+		}
+		else if (t == OP_COND)
+		{
+			while (ops.size() > base && (ops.back().kind == PendingOp::PREFIX
+				|| ops.back().kind == PendingOp::BINARY))
+				reduce();
 
-// bitwise_xor { '|' bitwise_xor }
-BINEXP(bitwise_or, bitwise_xor, t == OP_OR, OR)
+			l.eat(t);
+			ops.push_back({ PendingOp::QUESTION, COND, 0 });
+		}
+		else
+		{
+			// everything up to the innermost bracket is done
+			while (ops.size() > base && ops.back().kind != PendingOp::PAREN
+				&& ops.back().kind != PendingOp::CALL && ops.back().kind != PendingOp::QUESTION)
+				reduce();
 
-// bitwise_and { '^' bitwise_and }
-BINEXP(bitwise_xor, bitwise_and, t == OP_XOR, XOR)
+			PendingOp::Kind open = ops.size() > base ? ops.back().kind : PendingOp::BINARY;
 
-// equality { '&' equality }
-BINEXP(bitwise_and, equality, t == OP_AMPER, AND)
+			if (t == OP_COLON && open == PendingOp::QUESTION)
+				ops.back().kind = PendingOp::COLON;
+			else if (t == RPAREN && open == PendingOp::PAREN)
+			{
+				ops.pop_back();
+				l.eat(t);
+				postfix();
+				continue;
+			}
+			else if (t == RPAREN && open == PendingOp::CALL)
+			{
+				AST::list_add(vals.back());
+				vals.pop_back();
+				close_call();
+				postfix();
+				continue;
+			}
+			else if (t == COMMA && open == PendingOp::CALL)
+			{
+				AST::list_add(vals.back());
+				vals.pop_back();
+			}
+			// end of the expression
+			else
+				break;
 
-// comparison { ( OP_EQ | OP_NE ) comparison }
-BINEXP_ASNODE(equality, comparison, t == OP_EQ || t == OP_NE)
+			l.eat(t);
+		}
 
-// shift { ( OP_LE | OP_GE | '<' | '>' ) shift }
-BINEXP_ASNODE(comparison, shift, t == OP_LE || t == OP_GE || t == OP_LT || t == OP_GT)
+		operand = true;
+	}
 
-// term { ( OP_SHR | OP_SHL ) term }
-BINEXP_ASNODE(shift, term, t == OP_SHL || t == OP_SHR)
+	// the innermost bracket wasn't closed
+	if (ops.size() > base)
+	{
+		switch (ops.back().kind) {
+			case PendingOp::PAREN: l.eat(RPAREN); break;
+			case PendingOp::CALL: l.eat(COMMA); break;
+			case PendingOp::QUESTION: l.eat(OP_COLON); break;
+		}
+	}
 
-// factor { ( '+' | '-' ) factor }
-BINEXP_ASNODE(term, factor, t == OP_ADD || t == OP_SUB)
+	AST out = vals.back();
+	vals.pop_back();
 
-// unop { ( '/' | '*' | '%' ) unop }
-BINEXP_ASNODE(factor, unop, t == OP_DIV || t == OP_MUL || t == OP_MOD)
+	return out;
+}
 
-// postfix | ( OP_INC | OP_DEC | '&' | '* ) lval | ( '!' | '~' | '-' ) unop
-// lhs = operand
-AST *Parser::unop()
+// pops the top operator and its operands off, pushes its node
+void Parser::reduce()
 {
-	TokType t = l.peek().type;
+	PendingOp op = ops.back();
+	ops.pop_back();
 
-	NodeType n;
-	bool lv = true;
+	AST rhs = vals.back();
+	vals.pop_back();
 
-	switch (t) {
-		case OP_INC: n = UN_INC; break;
-		case OP_DEC: n = UN_DEC; break;
-		case OP_AMPER: n = REF; break;
-		case OP_MUL: n = PTR; break;
-		case OP_SUB:
-			n = NEG; lv = false; break;
-		case OP_LOGNOT:
-		case OP_NOT:
-			n = Parser::asnode(t);
-			lv = false;
+	switch (op.kind) {
+		case PendingOp::PREFIX:
+			vals.push_back(AST::make(op.node, INT, rhs));
 			break;
-		default: return postfix();
-	}
 
-	l.eat(t);
+		// types are filled in by check_types
+		case PendingOp::BINARY:
+		case PendingOp::ASSIGN:
+			vals.back() = AST::make(op.node, INT, vals.back(), rhs);
+			break;
 
-	return new AST(n, INT, lv ? lval() : unop());
+		// lhs = cond, mid = true, rhs = false
+		case PendingOp::COLON: {
+			AST t = vals.back();
+			vals.pop_back();
+			AST c = vals.back();
+			vals.back() = AST::make(COND, INT, c, t, rhs);
+			break;
+		}
+	}
 }
 
-// primary [ OP_INC | OP_DEC ]
-AST *Parser::postfix()
+// [ OP_INC | OP_DEC ] after the primary on top of vals
+void Parser::postfix()
 {
-	AST *p = primary();
-
 	TokType t = l.peek().type;
 	if (t == OP_INC || t == OP_DEC)
 	{
 		l.eat(t);
-		return new AST((t == OP_INC) ? POST_INC : POST_DEC, INT, p);
+		vals.back() = AST::make((t == OP_INC) ? POST_INC : POST_DEC, INT, vals.back());
 	}
-	else
-		return p;
 }
 
-// call | INT_CONSTANT | FP_CONSTANT | STR_CONSTANT | CHAR_CONSTANT | IDENTIFIER | '(' expr ')'
-AST *Parser::primary()
+// IDENTIFIER '(', the function goes on vals and the args on the list scratch
+void Parser::open_call()
 {
-	Token tok = l.peek();
-	TokType t = tok.type;
-
-	// if (t == INT_CONSTANT || t == FP_CONSTANT || t == STR_CONSTANT || t == CHAR_CONSTANT)
-	if (t == INT_CONSTANT)
-	{
-		l.eat(t);
-		return new AST(INT_CONST, INT, std::get<long long>(tok.val));
-	}
-	else if (t == CHAR_CONSTANT)
-	{
-		l.eat(t);
-		return new AST(INT_CONST, CHAR, std::get<long long>(tok.val));
-	}
-	else if (t == IDENTIFIER)
-	{
-		if (l.peek(2).type == LPAREN)
-			return call();
-		else
-			// scope entry and scope id
-			return Scope::s(cur_scope)->get(std::get<std::string>(l.eat(IDENTIFIER).val));
-	}
-	else if (t == LPAREN)
-	{
-		l.eat(LPAREN);
-		AST *out = expr();
-		l.eat(RPAREN);
-
-		return out;
-	}
-
-	err_tok(std::string("Invalid expression ") + l.getname(t), tok);
-}
-
-// IDENTIFIER '(' [ expr { ',' expr } ] ')'
-// lhs = var, rhs = params
-AST *Parser::call()
-{
-	AST *out = new AST(CALL);
-	out->rhs = new AST(LIST);
-
 	// get symbol from scope
 	Token id = l.eat(IDENTIFIER);
 
-	out->lhs = Scope::s(cur_scope)->get(std::get<std::string>(id.val));
+	AST fn = var(id);
 
-	if (out->lhs->get_sym().vtype != V_FUNC)
-		err_tok("Attempting to call variable", id);
+	if (fn.get_sym().vtype != V_FUNC)
+		err_tok("Attempting to call variable", l, id);
 
 	l.eat(LPAREN);
 
-	int param_count = 0;
-	AST *list_bottom = out->rhs;
+	vals.push_back(fn);
+	ops.push_back({ PendingOp::CALL, CALL, 0, AST::list_start() });
+}
 
-	Token tok = l.peek();
-	TokType t = tok.type;
-	while (t != RPAREN)
-	{
-		list_bottom = AST::append(list_bottom, expr(), LIST);
-		++param_count;
+// ')', replaces the function on vals with the call
+// lhs = var, rhs = params
+void Parser::close_call()
+{
+	Token tok = l.eat(RPAREN);
 
-		if (l.peek().type != RPAREN)
-			l.eat(COMMA);
-		
-		tok = l.peek();
-		t = tok.type;
-	}
+	std::size_t args = ops.back().args;
+	ops.pop_back();
 
-	if (!t)
-		err_tok("Unclosed parentheses in function call", tok);
-	
-	if (param_count != out->lhs->get_sym().val)
-		err_tok("Too many arguments to function call", tok);
+	AST fn = vals.back();
 
-	l.eat(RPAREN);
+	if (static_cast<int>(AST::list_start() - args) != fn.get_sym().val)
+		err_tok("Too many arguments to function call", l, tok);
 
-	return out;
+	vals.back() = AST::make(CALL, INT, fn, AST::make_list(args));
 }
 
 // -------- main program blk -------- //
 
-// statementlist = { func | decl }
-AST *Parser::parse()
+// func | decl
+AST Parser::parse_next()
 {
-	AST *out = new AST(LIST);
-	AST *bottom = out;
+	l.release();
 
-	TokType t = l.peek(3).type;
+	if (!l.peek().type)
+		return AST();
 
-	while (l.peek().type)
-	{
-		if (t == LPAREN)
-			bottom = AST::append(bottom, func(), LIST);
-		else
-			bottom = AST::append(bottom, decl(), LIST);
+	if (l.peek(3).type == LPAREN)
+		return func();
+	else
+		return decl();
+}
 
-		t = l.peek(3).type;
-	}
+// statementlist = { func | decl }
+AST Parser::parse()
+{
+	std::size_t start = AST::list_start();
+
+	while (AST item = parse_next())
+		AST::list_add(item);
 	
-	return out;
+	return AST::make_list(start);
 }
 
 // omitted: and, inc, dec
@@ -732,7 +974,7 @@ NodeType Parser::asnode(TokType t)
 	}
 }
 
-PrimType Parser::asptype(TokType t)
+Type Parser::asptype(TokType t)
 {
 	switch (t) {
 		case KEY_INT:
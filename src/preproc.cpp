@@ -0,0 +1,759 @@
+#include <preproc.hpp>
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+
+#include <err.hpp>
+
+// -------- #if expressions -------- //
+
+static int prec(TokType t)
+{
+	switch (t) {
+		case OP_MUL: case OP_DIV: case OP_MOD: return 10;
+		case OP_ADD: case OP_SUB: return 9;
+		case OP_SHL: case OP_SHR: return 8;
+		case OP_LT: case OP_GT: case OP_LE: case OP_GE: return 7;
+		case OP_EQ: case OP_NE: return 6;
+		case OP_AMPER: return 5;
+		case OP_XOR: return 4;
+		case OP_OR: return 3;
+		case OP_LOGAND: return 2;
+		case OP_LOGOR: return 1;
+		default: return 0;
+	}
+}
+
+// evaluated on long long, toks ends with the PP_EOL
+struct IfExpr
+{
+	const Preproc &pp;
+	const std::vector<Token> &toks;
+	std::size_t at;
+	// inside a side of && || ?: that isn't used, so / 0 is fine
+	int dead;
+
+	long long ternary();
+	long long binary(int min);
+	long long unary();
+	long long apply(const Token &op, long long a, long long b);
+};
+
+long long IfExpr::ternary()
+{
+	long long c = binary(1);
+	if (toks[at].type != OP_COND)
+		return c;
+	++at;
+
+	dead += !c;
+	long long a = ternary();
+	dead -= !c;
+
+	if (toks[at].type != OP_COLON)
+		err_tok("Expected a \':\' in #if", pp, toks[at]);
+	++at;
+
+	dead += !!c;
+	long long b = ternary();
+	dead -= !!c;
+
+	return c ? a : b;
+}
+
+long long IfExpr::binary(int min)
+{
+	long long lhs = unary();
+
+	for (;;)
+	{
+		const Token &op = toks[at];
+		int p = prec(op.type);
+		if (!p || p < min)
+			return lhs;
+		++at;
+
+		bool skip = (op.type == OP_LOGAND && !lhs) || (op.type == OP_LOGOR && lhs);
+
+		dead += skip;
+		long long rhs = binary(p + 1);
+		dead -= skip;
+
+		lhs = apply(op, lhs, rhs);
+	}
+}
+
+long long IfExpr::unary()
+{
+	const Token &t = toks[at];
+	if (t.type == PP_EOL)
+		err_tok("Expected an expression in #if", pp, t);
+	++at;
+
+	switch (t.type) {
+		case INT_CONSTANT:
+		case CHAR_CONSTANT:
+			return t.ival;
+		case OP_ADD: return unary();
+		case OP_SUB: return 0ull - static_cast<unsigned long long>(unary());
+		case OP_LOGNOT: return !unary();
+		case OP_NOT: return ~unary();
+		case LPAREN:
+		{
+			long long v = ternary();
+			if (toks[at].type != RPAREN)
+				err_tok("Expected a \')\' in #if", pp, toks[at]);
+			++at;
+			return v;
+		}
+		default:
+			err_tok("Invalid token in #if", pp, t);
+			return 0;
+	}
+}
+
+long long IfExpr::apply(const Token &op, long long a, long long b)
+{
+	// wrap instead of overflowing
+	unsigned long long ua = a, ub = b;
+
+	switch (op.type) {
+		case OP_MUL: return ua * ub;
+		case OP_DIV:
+		case OP_MOD:
+			if (!b)
+			{
+				if (!dead)
+					err_tok("Division by zero in #if", pp, op);
+				return 0;
+			}
+			if (b == -1)
+				return op.type == OP_DIV ? 0ull - ua : 0;
+			return op.type == OP_DIV ? a / b : a % b;
+		case OP_ADD: return ua + ub;
+		case OP_SUB: return ua - ub;
+		case OP_SHL: return ua << (ub & 63);
+		case OP_SHR: return a >> (ub & 63);
+		case OP_LT: return a < b;
+		case OP_GT: return a > b;
+		case OP_LE: return a <= b;
+		case OP_GE: return a >= b;
+		case OP_EQ: return a == b;
+		case OP_NE: return a != b;
+		case OP_AMPER: return a & b;
+		case OP_XOR: return a ^ b;
+		case OP_OR: return a | b;
+		case OP_LOGAND: return a && b;
+		case OP_LOGOR: return a || b;
+		default: return 0;
+	}
+}
+
+// -------- files -------- //
+
+Preproc::Preproc(const std::string &filename, const std::vector<std::string> &include_dirs)
+	: include_dirs(include_dirs), high(0), head(0), buffered(0)
+{
+	n_define = intern("define");
+	n_undef = intern("undef");
+	n_include = intern("include");
+	n_ifdef = intern("ifdef");
+	n_ifndef = intern("ifndef");
+	n_elif = intern("elif");
+	n_endif = intern("endif");
+	n_pragma = intern("pragma");
+	n_once = intern("once");
+	n_defined = intern("defined");
+
+	File *f = open(filename, false);
+
+	// so that #pragma once works if a header includes it
+	char real[PATH_MAX];
+	if (filename != "-" && realpath(filename.c_str(), real))
+		by_path[real] = f;
+
+	enter(f, false);
+}
+
+Preproc::File *Preproc::open(const std::string &path, bool cache)
+{
+	files.push_back(std::make_unique<File>());
+	File *f = files.back().get();
+
+	// only headers are named in error messages
+	f->path = path;
+	f->lex = std::make_unique<Lexer>(path, files.size() > 1);
+	f->cache = cache;
+	f->done = false;
+	f->once = false;
+	f->guard = 0;
+
+	return f;
+}
+
+void Preproc::enter(File *f, bool replay)
+{
+	// the includer's offsets stop here
+	if (!inputs.empty() && !inputs.back().replay)
+		high = inputs.back().delta + inputs.back().file->lex->offset() + 1;
+
+	inputs.push_back({ f, replay, 0, 0, conds.size(), false });
+
+	if (!replay)
+		resume();
+}
+
+void Preproc::resume()
+{
+	Input &in = inputs.back();
+	std::size_t local = in.file->lex->offset();
+
+	in.delta = high - local;
+	segments.push_back({ high, local, in.file });
+}
+
+Name Preproc::find_guard(const File &f) const
+{
+	const std::vector<Token> &t = f.toks;
+
+	// #ifndef X as the first line
+	if (t.size() < 8 || t[0].type != PP_HASH || !is(t[1], n_ifndef)
+		|| t[2].type != IDENTIFIER || t[3].type != PP_EOL)
+		return 0;
+
+	// and the #endif for it as the last
+	int depth = 0;
+	for (std::size_t i = 0; i + 1 < t.size(); ++i)
+	{
+		if (t[i].type != PP_HASH)
+			continue;
+
+		const Token &d = t[i + 1];
+		if (d.type == KEY_IF || is(d, n_ifdef) || is(d, n_ifndef))
+			++depth;
+		else if (is(d, n_endif) && --depth == 0)
+			return i + 4 == t.size() && t[i + 2].type == PP_EOL ? t[2].name : 0;
+	}
+
+	return 0;
+}
+
+const Preproc::Segment &Preproc::segment(std::size_t offset) const
+{
+	auto it = std::upper_bound(segments.begin(), segments.end(), offset,
+		[](std::size_t off, const Segment &s) { return off < s.start; });
+
+	return *(it - 1);
+}
+
+std::string_view Preproc::text(const Token &t) const
+{
+	const Segment &s = segment(t.offset);
+
+	Token local = t;
+	local.offset = t.offset - s.start + s.local;
+
+	return s.file->lex->text(local);
+}
+
+SrcPos Preproc::pos(std::size_t offset) const
+{
+	const Segment &s = segment(offset);
+	return s.file->lex->pos(offset - s.start + s.local);
+}
+
+void Preproc::release()
+{
+	const Token &t = peek();
+	const Segment &s = segment(t.offset);
+	s.file->lex->release(t.offset - s.start + s.local);
+}
+
+// -------- tokens -------- //
+
+Token Preproc::raw()
+{
+	for (;;)
+	{
+		Input &in = inputs.back();
+		File &f = *in.file;
+		Token t;
+
+		if (in.replay && !in.lexing)
+		{
+			t = f.toks[in.at++];
+
+			// a group that was false when the file was read, it only has
+			// to be lexed if it's kept this time
+			if (t.type == PP_SKIP)
+			{
+				if (active())
+				{
+					f.lex->seek(t.ival);
+					in.delta = t.offset - t.ival;
+					in.lexing = true;
+				}
+				continue;
+			}
+		}
+		else
+		{
+			t = f.lex->next();
+
+			// tokens store 32 bit offsets
+			std::size_t off = in.delta + t.offset;
+			if (off > UINT32_MAX)
+				err("Too much source text");
+			t.offset = off;
+
+			// the group ends at the next directive, which is cached
+			if (in.lexing)
+			{
+				if (t.offset < f.toks[in.at].offset)
+					return t;
+
+				in.lexing = false;
+				continue;
+			}
+
+			if (f.cache)
+				f.toks.push_back(t);
+		}
+
+		if (t.type != TOK_EOF)
+			return t;
+
+		if (conds.size() != in.conds)
+			err_tok("Unterminated #if", *this, t);
+
+		if (inputs.size() == 1)
+			return t;
+
+		// end of a header, back to the file that included it
+		if (!in.replay)
+		{
+			high = t.offset + 1;
+
+			if (f.cache)
+			{
+				f.done = true;
+				f.guard = find_guard(f);
+			}
+		}
+
+		inputs.pop_back();
+
+		if (!inputs.back().replay)
+			resume();
+	}
+}
+
+Token Preproc::next()
+{
+	for (;;)
+	{
+		Token t;
+
+		if (!frames.empty())
+		{
+			Frame &f = frames.back();
+			if (f.at == f.toks->size())
+			{
+				frames.pop_back();
+				continue;
+			}
+
+			t = (*f.toks)[f.at++];
+		}
+		else
+		{
+			t = raw();
+
+			if (t.type == PP_HASH)
+			{
+				directive();
+
+				if (!active())
+					skip_group();
+				continue;
+			}
+
+			if (t.type != TOK_EOF && !active())
+				continue;
+		}
+
+		// a macro isn't replaced inside of itself
+		if (t.type == IDENTIFIER)
+		{
+			auto it = macros.find(t.name);
+
+			if (it != macros.end() && std::none_of(frames.begin(), frames.end(),
+				[&](const Frame &f) { return f.macro == t.name; }))
+			{
+				frames.push_back({ t.name, &it->second, 0 });
+				continue;
+			}
+		}
+
+		return t;
+	}
+}
+
+// -------- directives -------- //
+
+void Preproc::directive()
+{
+	Token d = raw();
+
+	// a '#' on its own
+	if (d.type == PP_EOL)
+		return;
+
+	if (d.type == KEY_IF || is(d, n_ifdef) || is(d, n_ifndef))
+	{
+		bool on = active();
+		bool take = false;
+
+		if (!on)
+			skip_line();
+		else if (d.type == KEY_IF)
+			take = eval_line();
+		else
+		{
+			Token name = raw();
+			if (name.type != IDENTIFIER)
+				err_tok("Expected a macro name", *this, name);
+			end_line();
+
+			take = (macros.count(name.name) != 0) == is(d, n_ifdef);
+		}
+
+		// no branch of an #if inside a skipped block is kept
+		conds.push_back({ take, take || !on, false });
+		return;
+	}
+
+	if (d.type == KEY_ELSE || is(d, n_elif) || is(d, n_endif))
+	{
+		std::string name(text(d));
+
+		if (conds.size() == inputs.back().conds)
+			err_tok("#" + name + " without #if", *this, d);
+
+		Cond &c = conds.back();
+
+		if (is(d, n_endif))
+		{
+			end_line();
+			conds.pop_back();
+			return;
+		}
+
+		if (c.seen_else)
+			err_tok("#" + name + " after #else", *this, d);
+
+		if (d.type == KEY_ELSE)
+		{
+			end_line();
+			c.active = !c.taken;
+			c.seen_else = true;
+		}
+		else if (c.taken)
+		{
+			skip_line();
+			c.active = false;
+		}
+		else
+			c.active = eval_line();
+
+		c.taken |= c.active;
+		return;
+	}
+
+	if (!active())
+	{
+		skip_line();
+		return;
+	}
+
+	if (is(d, n_define))
+		define();
+	else if (is(d, n_undef))
+	{
+		Token name = raw();
+		if (name.type != IDENTIFIER)
+			err_tok("Expected a macro name", *this, name);
+		end_line();
+
+		macros.erase(name.name);
+	}
+	else if (is(d, n_include))
+		include();
+	else if (is(d, n_pragma))
+	{
+		Token t = raw();
+
+		// others are ignored
+		if (is(t, n_once))
+		{
+			inputs.back().file->once = true;
+			end_line();
+		}
+		else if (t.type != PP_EOL)
+			skip_line();
+	}
+	else
+		err_tok("Invalid directive", *this, d);
+}
+
+void Preproc::define()
+{
+	Token name = raw();
+	if (name.type != IDENTIFIER)
+		err_tok("Expected a macro name", *this, name);
+
+	Token t = raw();
+
+	// NAME( with no space between is a function-like macro
+	if (t.type == LPAREN && t.offset == name.offset + name.len)
+		err_tok("Function-like macros are not supported", *this, t);
+
+	// errors in an expansion point at the body, wherever it's used
+	Input &in = inputs.back();
+
+	std::vector<Token> body;
+	for (; t.type != PP_EOL; t = raw())
+	{
+		if (!in.replay)
+			in.file->lex->pin(t.offset - in.delta);
+		body.push_back(t);
+	}
+
+	macros[name.name] = std::move(body);
+}
+
+void Preproc::include()
+{
+	Token t = raw();
+	std::string name;
+	bool quoted = t.type == STR_CONSTANT;
+
+	if (quoted)
+	{
+		std::string_view s = text(t);
+		name = s.substr(1, s.size() - 2);
+	}
+	else if (t.type == OP_LT)
+	{
+		for (t = raw(); t.type != OP_GT; t = raw())
+		{
+			if (t.type == PP_EOL)
+				err_tok("Expected a \'>\'", *this, t);
+			name += text(t);
+		}
+	}
+	else
+		err_tok("Expected a file name after #include", *this, t);
+
+	end_line();
+
+	// "" looks next to the including file first
+	std::vector<std::string> dirs;
+	if (name[0] == '/')
+		dirs.push_back("");
+	else
+	{
+		if (quoted)
+		{
+			const std::string &cur = inputs.back().file->path;
+			dirs.push_back(cur.substr(0, cur.rfind('/') + 1));
+		}
+
+		for (const std::string &dir : include_dirs)
+			dirs.push_back(dir.back() == '/' ? dir : dir + '/');
+	}
+
+	char real[PATH_MAX];
+	std::string path;
+
+	for (const std::string &dir : dirs)
+		if (realpath((dir + name).c_str(), real))
+		{
+			path = real;
+			break;
+		}
+
+	if (path.empty())
+		err_tok("Could not find \'" + name + "\'", *this, t);
+
+	if (inputs.size() == MAX_DEPTH)
+		err_tok("#include nested too deeply", *this, t);
+
+	File *&f = by_path[path];
+
+	if (f && f->once)
+		return;
+
+	// seen in full before, skip it or replay its tokens
+	if (f && f->done)
+	{
+		if (!f->guard || !macros.count(f->guard))
+			enter(f, true);
+		return;
+	}
+
+	// a file still being read includes itself, so it can't be cached
+	File *h = open(path, !f);
+	if (!f)
+		f = h;
+
+	enter(h, false);
+}
+
+bool Preproc::eval_line()
+{
+	std::vector<Token> line;
+	for (Token t = raw(); ; t = raw())
+	{
+		line.push_back(t);
+		if (t.type == PP_EOL)
+			break;
+	}
+
+	std::vector<Token> toks;
+	std::vector<Name> blocked;
+	expand_into(line, toks, blocked);
+
+	IfExpr e = { *this, toks, 0, 0 };
+	long long v = e.ternary();
+
+	if (toks[e.at].type != PP_EOL)
+		err_tok("Invalid token in #if", *this, toks[e.at]);
+
+	return v != 0;
+}
+
+void Preproc::expand_into(const std::vector<Token> &line, std::vector<Token> &out, std::vector<Name> &blocked)
+{
+	for (std::size_t i = 0; i < line.size(); ++i)
+	{
+		Token t = line[i];
+
+		// defined X or defined(X)
+		if (is(t, n_defined))
+		{
+			bool paren = i + 1 < line.size() && line[i + 1].type == LPAREN;
+			std::size_t n = i + 1 + paren;
+
+			if (n >= line.size() || line[n].type != IDENTIFIER
+				|| (paren && (n + 1 >= line.size() || line[n + 1].type != RPAREN)))
+				err_tok("Expected a macro name after defined", *this, t);
+
+			t.type = INT_CONSTANT;
+			t.ival = macros.count(line[n].name);
+			i = n + paren;
+		}
+		else if (t.type == IDENTIFIER)
+		{
+			auto it = macros.find(t.name);
+
+			if (it != macros.end() && std::find(blocked.begin(), blocked.end(), t.name) == blocked.end())
+			{
+				blocked.push_back(t.name);
+				expand_into(it->second, out, blocked);
+				blocked.pop_back();
+				continue;
+			}
+
+			// any name left is 0
+			t.type = INT_CONSTANT;
+			t.ival = 0;
+		}
+
+		out.push_back(t);
+	}
+}
+
+void Preproc::end_line()
+{
+	Token t = raw();
+	if (t.type != PP_EOL)
+		err_tok("Extra tokens after directive", *this, t);
+}
+
+void Preproc::skip_line()
+{
+	while (raw().type != PP_EOL);
+}
+
+// the group isn't lexed, the cache gets a PP_SKIP in its place. when
+// replaying, its tokens are dropped one at a time by next
+void Preproc::skip_group()
+{
+	Input &in = inputs.back();
+	if (in.replay)
+		return;
+
+	File &f = *in.file;
+	if (f.cache)
+	{
+		// streamed input can't be lexed again, so it can't be cached
+		if (f.lex->seekable())
+		{
+			Token t(PP_SKIP, in.delta + f.lex->offset(), 0);
+			t.ival = f.lex->offset();
+			f.toks.push_back(t);
+		}
+		else
+		{
+			f.cache = false;
+			std::vector<Token>().swap(f.toks);
+		}
+	}
+
+	f.lex->skip_group();
+}
+
+// -------- parser interface -------- //
+
+Token Preproc::eat(TokType expected)
+{
+	Token next = peek();
+	if (next.type != expected)
+	{
+		if (expected == SEMI)
+			err_tok("Expected a \';\'", *this, next);
+		else
+		{
+			std::string msg("Invalid token: expected ");
+			msg += getname(expected);
+			msg += ", got ";
+			msg += getname(next.type);
+
+			err_tok(msg, *this, next);
+		}
+	}
+
+	// remove cached value
+	head = (head + 1) & (LOOKAHEAD - 1);
+	--buffered;
+
+	return next;
+}
+
+const Token &Preproc::peek(unsigned lookahead)
+{
+	if (lookahead > LOOKAHEAD)
+		err("Parser looked too far ahead");
+
+	// token doesn't exist in buffer
+	while (buffered < lookahead)
+	{
+		tok_buf[(head + buffered) & (LOOKAHEAD - 1)] = next();
+		++buffered;
+	}
+
+	return tok_buf[(head + lookahead - 1) & (LOOKAHEAD - 1)];
+}
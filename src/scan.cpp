@@ -0,0 +1,78 @@
+#include <scan.hpp>
+
+#ifdef SCAN_SIMD
+#include <simd.hpp>
+#endif
+
+// -------- scalar fallback -------- //
+
+static const char *skip_space_s(const char *p)
+{
+	while (is_space(*p))
+		++p;
+	return p;
+}
+
+static const char *skip_ident_s(const char *p)
+{
+	while (is_alnum(*p) || *p == '_')
+		++p;
+	return p;
+}
+
+static const char *skip_digits_s(const char *p)
+{
+	while (is_digit(*p))
+		++p;
+	return p;
+}
+
+static const char *find_char_s(const char *p, char a)
+{
+	while (*p && *p != a)
+		++p;
+	return p;
+}
+
+static const char *find_char2_s(const char *p, char a, char b)
+{
+	while (*p && *p != a && *p != b)
+		++p;
+	return p;
+}
+
+// -------- dispatch -------- //
+
+struct Scanners
+{
+	const char *(*skip_space)(const char *);
+	const char *(*skip_ident)(const char *);
+	const char *(*skip_digits)(const char *);
+	const char *(*find_char)(const char *, char);
+	const char *(*find_char2)(const char *, char, char);
+};
+
+static Scanners pick_scanners()
+{
+#ifdef SCAN_SIMD
+	__builtin_cpu_init();
+
+#ifdef SCAN_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return { avx2::skip_space, avx2::skip_ident, avx2::skip_digits, avx2::find_char, avx2::find_char2 };
+#endif
+
+	if (__builtin_cpu_supports("sse2"))
+		return { sse2::skip_space, sse2::skip_ident, sse2::skip_digits, sse2::find_char, sse2::find_char2 };
+#endif
+
+	return { skip_space_s, skip_ident_s, skip_digits_s, find_char_s, find_char2_s };
+}
+
+static const Scanners SCAN = pick_scanners();
+
+const char *skip_space(const char *p) { return SCAN.skip_space(p); }
+const char *skip_ident(const char *p) { return SCAN.skip_ident(p); }
+const char *skip_digits(const char *p) { return SCAN.skip_digits(p); }
+const char *find_char(const char *p, char a) { return SCAN.find_char(p, a); }
+const char *find_char2(const char *p, char a, char b) { return SCAN.find_char2(p, a, b); }
@@ -0,0 +1,31 @@
+#include <scan.hpp>
+
+// built with -mavx2, only called after a runtime cpu check
+#ifdef SCAN_AVX2
+
+#include <immintrin.h>
+
+#include <simd.hpp>
+
+struct Avx2
+{
+	using T = __m256i;
+	static const int W = 32;
+	static const std::uint32_t FULL = 0xffffffff;
+
+	static T load(const char *p) { return _mm256_load_si256(reinterpret_cast<const T *>(p)); }
+	static T eq(T v, char c) { return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)); }
+	// signed compare, so chars >= 0x80 are never in range
+	static T in(T v, char lo, char hi)
+	{
+		return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+		                        _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+	}
+	static T lower(T v) { return _mm256_or_si256(v, _mm256_set1_epi8(0x20)); }
+	static T or_(T a, T b) { return _mm256_or_si256(a, b); }
+	static std::uint32_t mask(T v) { return _mm256_movemask_epi8(v); }
+};
+
+SCAN_DEFS(avx2, Avx2)
+
+#endif
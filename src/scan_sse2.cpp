@@ -0,0 +1,30 @@
+#include <scan.hpp>
+
+#ifdef SCAN_SIMD
+
+#include <emmintrin.h>
+
+#include <simd.hpp>
+
+struct Sse2
+{
+	using T = __m128i;
+	static const int W = 16;
+	static const std::uint32_t FULL = 0xffff;
+
+	static T load(const char *p) { return _mm_load_si128(reinterpret_cast<const T *>(p)); }
+	static T eq(T v, char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+	// signed compare, so chars >= 0x80 are never in range
+	static T in(T v, char lo, char hi)
+	{
+		return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+		                     _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+	}
+	static T lower(T v) { return _mm_or_si128(v, _mm_set1_epi8(0x20)); }
+	static T or_(T a, T b) { return _mm_or_si128(a, b); }
+	static std::uint32_t mask(T v) { return _mm_movemask_epi8(v); }
+};
+
+SCAN_DEFS(sse2, Sse2)
+
+#endif
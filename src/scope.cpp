@@ -4,44 +4,65 @@
 
 int Scope::scope_count = 0;
 
-AST *Scope::get(const std::string &name)
+int Scope::add(const Sym &s)
 {
-	for (unsigned i = 0; i < syms.size(); ++i)
-	{
-		if (syms[i].name == name)
-			return new AST(syms[i].type, i, id);
-	}
+	std::vector<Sym> &table = id == GLOBAL ? globals : locals;
 
-	if (parent_id >= 0)
-		return Scope::scopes[parent_id]->get(name);
-	else
-	{
-		std::cerr << "Could not find variable " << name << '\n';
-		exit(1);
-	}
+	int out = table.size();
+	table.push_back(s);
+	syms.push_back(out);
+
+	// later ones with the same name don't replace the first
+	index.emplace(s.name, out);
+
+	return out;
 }
 
-bool Scope::in_scope(const std::string &name)
+int Scope::find(Name name, int &id) const
 {
-	for (unsigned i = 0; i < syms.size(); ++i)
+	for (const Scope *s = this; ; s = scopes[s->parent_id])
 	{
-		if (syms[i].name == name)
-			return true;
-	}
+		id = s->find_local(name);
+		if (id >= 0)
+			return s->id;
 
-	return false;
+		if (s->id == GLOBAL)
+			return -1;
+	}
 }
 
 //
 
 std::vector<Scope*> Scope::scopes;
+std::vector<Sym> Scope::globals, Scope::locals;
+std::vector<Type> Scope::param_types;
 
 int Scope::new_scope(int cur)
 {
 	Scope *out = new Scope;
 	out->parent_id = cur;
 	out->id = Scope::scope_count++;
+	out->size = 0;
 	scopes.push_back(out);
 
-	return out->id;;
+	return out->id;
+}
+
+std::uint32_t Scope::add_params(const Type *types, int count)
+{
+	std::uint32_t out = param_types.size();
+	param_types.insert(param_types.end(), types, types + count);
+	return out;
+}
+
+void Scope::rewind(const Mark &m)
+{
+	while (scope_count > m.scopes)
+	{
+		delete scopes.back();
+		scopes.pop_back();
+		--scope_count;
+	}
+
+	locals.erase(locals.begin() + m.locals, locals.end());
 }
@@ -0,0 +1,294 @@
+#include <sema.hpp>
+
+#include <utility>
+#include <vector>
+
+#include <types.hpp>
+#include <err.hpp>
+
+// return type of the function being checked
+static Type ret_type = INT;
+
+// type of an operand without qualifiers, errors if it can't be used as a value
+static Type value(AST n)
+{
+	p_sizeof(n.ptype());
+	return type_info(n.ptype()).unqual;
+}
+
+// an integer constant is given the type it's converted to instead of
+// being widened at runtime
+static AST convert(Type out, AST in)
+{
+	Type u = type_info(out).unqual;
+	bool ptr = type_info(u).kind == T_PTR;
+
+	if (in.type() == INT_CONST && ((u > VOID && u < P_COUNT) || ptr))
+	{
+		// only 0 is a null pointer
+		if (ptr && in.val())
+			warning("Conversion between int and " + type_name(out) + " without a cast");
+		// same as truncating it at runtime
+		if (u == CHAR)
+			in.val() = static_cast<signed char>(in.val());
+
+		in.ptype() = u;
+		return in;
+	}
+
+	return compat_types(out, in);
+}
+
+// integer promotion, arithmetic is never done on types narrower than int
+static AST promote(AST in)
+{
+	return p_sizeof(in.ptype()) < Long ? convert(INT, in) : in;
+}
+
+// in counted in elements of what p points to, as a long of bytes
+static AST scaled(AST in, Type p)
+{
+	if (type_info(value(in)).kind == T_PTR)
+		err("Invalid operands " + type_name(p) + " and " + type_name(in.ptype()));
+
+	std::uint32_t bytes = type_info(type_info(p).of).bytes;
+	in = convert(LONG, in);
+
+	if (bytes == 1)
+		return in;
+	if (in.type() == INT_CONST)
+	{
+		in.val() *= bytes;
+		return in;
+	}
+
+	return AST::make(MUL, LONG, in, AST::make(INT_CONST, LONG, static_cast<int>(bytes)));
+}
+
+// binop with a pointer on at least one side. the integer side of + and -
+// is scaled, and the difference of two pointers is in elements
+static void pointer_op(AST n)
+{
+	NodeType t = n.type();
+	Type l = value(n.lhs()), r = value(n.rhs());
+	bool lp = type_info(l).kind == T_PTR, rp = type_info(r).kind == T_PTR;
+
+	if (t >= N_LE && t <= N_GT)
+	{
+		if (lp)
+			n.rhs() = convert(l, n.rhs());
+		else
+			n.lhs() = convert(r, n.lhs());
+		n.ptype() = INT;
+	}
+	else if (t == ADD && !(lp && rp))
+	{
+		if (lp)
+			n.rhs() = scaled(n.rhs(), l);
+		else
+			n.lhs() = scaled(n.lhs(), r);
+		n.ptype() = lp ? l : r;
+	}
+	else if (t == SUB && lp && !rp)
+	{
+		n.rhs() = scaled(n.rhs(), l);
+		n.ptype() = l;
+	}
+	else if (t == SUB && lp && rp)
+	{
+		if (type_info(l).plain != type_info(r).plain)
+			err("Incompatible pointer types " + type_name(l) + " and " + type_name(r));
+
+		std::uint32_t bytes = type_info(type_info(l).of).bytes;
+		n.ptype() = LONG;
+		if (bytes == 1)
+			return;
+
+		// exact, so a signed divide is enough
+		AST diff = AST::make(SUB, LONG, n.lhs(), n.rhs());
+		n.type() = DIV;
+		n.lhs() = diff;
+		n.rhs() = AST::make(INT_CONST, LONG, static_cast<int>(bytes));
+	}
+	else
+		err("Invalid operands " + type_name(l) + " and " + type_name(r) + " to " + NODE_NAMES[t]);
+}
+
+// kids are done, n gets its type
+static void check_node(AST n)
+{
+	NodeType t = n.type();
+
+	// binop
+	if (t >= SHR && t <= XOR)
+	{
+		if (t == LOGAND || t == LOGOR)
+		{
+			value(n.lhs());
+			value(n.rhs());
+			n.ptype() = INT;
+			return;
+		}
+
+		if (type_info(value(n.lhs())).kind == T_PTR || type_info(value(n.rhs())).kind == T_PTR)
+		{
+			pointer_op(n);
+			return;
+		}
+
+		n.lhs() = promote(n.lhs());
+		n.rhs() = promote(n.rhs());
+		compat_types(n);
+
+		// both sides have the wider type now
+		n.ptype() = (t >= N_LE && t <= N_GT) ? INT : value(n.lhs());
+		return;
+	}
+
+	// assignment
+	if ((t >= SET && t <= SET_OR) || t == DECL_SET)
+	{
+		Type l = n.lhs().get_sym().type;
+
+		if (t != DECL_SET && (type_info(l).quals & Q_CONST))
+			err("Assignment to const variable " + std::string(name_str(n.lhs().get_sym().name)));
+
+		// p += n and p -= n step by elements
+		if (type_info(l).kind == T_PTR && (t == SET_ADD || t == SET_SUB))
+			n.rhs() = scaled(n.rhs(), l);
+		else if (type_info(l).kind == T_PTR && t != SET && t != DECL_SET)
+			err("Invalid operands " + type_name(l) + " and " + type_name(n.rhs().ptype()) + " to " + NODE_NAMES[t]);
+		else
+			n.rhs() = convert(l, n.rhs());
+		n.ptype() = l;
+		return;
+	}
+
+	switch (t) {
+		case VAR:
+			n.ptype() = n.get_sym().type;
+			break;
+
+		case NOT:
+		case NEG:
+			n.lhs() = promote(n.lhs());
+			n.ptype() = value(n.lhs());
+			break;
+
+		case UN_INC:
+		case UN_DEC:
+		case POST_INC:
+		case POST_DEC:
+			n.ptype() = value(n.lhs());
+			break;
+
+		case LOGNOT:
+			value(n.lhs());
+			n.ptype() = INT;
+			break;
+
+		case REF:
+			n.ptype() = pointer_to(n.lhs().ptype());
+			break;
+
+		case PTR:
+			if (type_info(n.lhs().ptype()).kind != T_PTR)
+				err("Dereference of non-pointer type " + type_name(n.lhs().ptype()));
+			n.ptype() = type_info(n.lhs().ptype()).of;
+			break;
+
+		// the symbol of a function has its return type, and the args are
+		// converted to the param types. kids of a loaded list can't be
+		// changed, so converted args go in a new list
+		case CALL: {
+			const Sym &fn = n.lhs().get_sym();
+			ASTList args = n.rhs().kids();
+			std::size_t start = AST::list_start();
+			bool changed = false;
+
+			for (std::uint32_t i = 0; i < args.size(); ++i)
+			{
+				AST arg = convert(Scope::param(fn, i), args[i]);
+				changed |= arg != args[i];
+				AST::list_add(arg);
+			}
+
+			if (changed)
+				n.rhs() = AST::make_list(start);
+			else
+				asts.scratch.resize(start);
+
+			n.ptype() = n.lhs().ptype();
+			break;
+		}
+
+		// both branches have the wider type
+		case COND: {
+			Type mid = value(n.mid()), rhs = value(n.rhs());
+			Type out = p_sizeof(mid) >= p_sizeof(rhs) ? mid : rhs;
+
+			n.mid() = convert(out, n.mid());
+			n.rhs() = convert(out, n.rhs());
+			n.ptype() = out;
+			break;
+		}
+
+		case RET:
+			if (n.lhs().type() == NONE)
+				break;
+
+			if (ret_type == VOID)
+				err("Returned a value from a void function");
+
+			n.lhs() = convert(ret_type, n.lhs());
+			n.ptype() = ret_type;
+			break;
+	}
+}
+
+// post order off an explicit stack, the second of each entry is set once
+// its kids have been pushed
+void check_types(AST root)
+{
+	std::vector<std::pair<AST, bool>> stack = { { root, false } };
+
+	while (!stack.empty())
+	{
+		auto &top = stack.back();
+		AST n = top.first;
+
+		if (!n)
+		{
+			stack.pop_back();
+			continue;
+		}
+
+		if (top.second)
+		{
+			stack.pop_back();
+			check_node(n);
+			continue;
+		}
+
+		top.second = true;
+
+		// functions don't nest, so it's the same until the next one
+		if (n.type() == FUNC)
+			ret_type = n.lhs().get_sym().type;
+
+		if (n.type() == LIST)
+		{
+			ASTList kids = n.kids();
+			for (std::uint32_t i = kids.size(); i-- > 0;)
+				stack.push_back({ kids[i], false });
+		}
+		else
+		{
+			// top is no longer valid past here
+			AST lhs = n.lhs(), mid = n.mid(), rhs = n.rhs();
+			stack.push_back({ rhs, false });
+			stack.push_back({ mid, false });
+			stack.push_back({ lhs, false });
+		}
+	}
+}
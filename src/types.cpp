@@ -1,80 +1,233 @@
 #include <types.hpp>
 
+#include <unordered_map>
+#include <vector>
+
 #include <parser.hpp>
 #include <err.hpp>
 
-bool compat_types(AST *parent, bool assigning)
+// -------- type table -------- //
+
+static std::vector<TypeInfo> types;
+
+// the fields that identify a type
+struct TypeKey
 {
-	PrimType l = parent->lhs->ptype;
-	PrimType r = parent->rhs->ptype;
-	
-	if (l == r)
-		return true;
+	TypeKind kind;
+	PrimType base;
+	std::uint8_t quals;
+	Type of;
+	std::uint32_t len;
 
-	if (p_sizeof(l) < p_sizeof(r))
+	bool operator==(const TypeKey &o) const
 	{
-		// value will be truncated
-		if (assigning)
-			warning("value will be truncated. where? idk you wrote it");
-		// lvalue will be widened
-		else
-			parent->lhs = new AST(WIDEN, parent->rhs->ptype, parent->lhs);
+		return kind == o.kind && base == o.base && quals == o.quals && of == o.of && len == o.len;
+	}
+};
+
+struct TypeKeyHash
+{
+	std::size_t operator()(const TypeKey &k) const
+	{
+		std::uint64_t h = (std::uint64_t(k.of) << 32 | k.len) * 0x9e3779b97f4a7c15ull;
+		return h ^ (k.kind << 16 | k.base << 8 | k.quals);
+	}
+};
+
+static std::unordered_map<TypeKey, Type, TypeKeyHash> type_index;
+
+static Type add_type(const TypeInfo &info)
+{
+	Type out = types.size();
+	types.push_back(info);
+	if (!info.quals)
+		types.back().unqual = out;
+	types.back().plain = out;
+
+	type_index.emplace(TypeKey{ info.kind, info.base, info.quals, info.of, info.len }, out);
+	return out;
+}
+
+// the base types go first so that their handles are their PrimTypes
+static struct BaseTypes {
+	BaseTypes()
+	{
+		static const std::uint32_t bytes[P_COUNT] = { 0, 0, 4, 1, 8 };
+		static const Size sizes[P_COUNT] = { Byte, Byte, Long, Byte, Quad };
+
+		for (int p = 0; p < P_COUNT; ++p)
+			add_type({ T_BASE, static_cast<PrimType>(p), 0, 0, 0, 0,
+				bytes[p], bytes[p] ? bytes[p] : 1, sizes[p], 0, 0 });
+	}
+} base_types;
+
+Type make_type(TypeKind kind, PrimType base, std::uint8_t quals, Type of, std::uint32_t len)
+{
+	auto it = type_index.find({ kind, base, quals, of, len });
+	if (it != type_index.end())
+		return it->second;
+
+	TypeInfo info = { kind, base, quals, 0, of, len, 0, 1, Quad, 0, 0 };
+
+	if (kind == T_BASE)
+		info = types[base];
+	else if (kind == T_PTR)
+	{
+		info.depth = types[of].depth + 1;
+		info.bytes = info.align = 8;
 	}
-	// rvalue will be widened
 	else
-		parent->rhs = new AST(WIDEN, parent->lhs->ptype, parent->rhs);
+	{
+		info.depth = types[of].depth;
+		info.bytes = types[of].bytes * len;
+		info.align = types[of].align;
+	}
+
+	info.quals = quals;
+
+	// a qualified type points to its plain version
+	if (quals)
+		info.unqual = make_type(kind, base, 0, of, len);
+
+	// and one with qualifiers below the top to its fully plain version
+	Type plain_of = kind == T_BASE ? of : types[of].plain;
+	Type out = add_type(info);
+	if (quals || plain_of != of)
+	{
+		Type plain = make_type(kind, base, 0, plain_of, len);
+		types[out].plain = plain;
+	}
+
+	return out;
+}
+
+Type pointer_to(Type t) { return make_type(T_PTR, types[t].base, 0, t, 0); }
+Type array_of(Type t, std::uint32_t len) { return make_type(T_ARRAY, types[t].base, 0, t, len); }
+
+bool array_fits(Type t, std::uint64_t len)
+{
+	return len <= MAX_OBJECT_BYTES && types[t].bytes * len <= MAX_OBJECT_BYTES;
+}
+
+Type qualified(Type t, std::uint8_t quals)
+{
+	const TypeInfo &i = types[t];
+	return make_type(i.kind, i.base, i.quals | quals, i.of, i.len);
+}
+
+const TypeInfo &type_info(Type t) { return types[t]; }
+std::uint32_t type_count() { return types.size(); }
+
+std::string type_name(Type t)
+{
+	const TypeInfo &i = types[t];
+	std::string out = (i.quals & Q_CONST) ? "const " : "";
+
+	switch (i.kind) {
+		case T_BASE: return out + PRIM_NAMES[i.base];
+		case T_PTR: return type_name(i.of) + " *" + (i.quals & Q_CONST ? "const" : "");
+		case T_ARRAY: return out + type_name(i.of) + " [" + std::to_string(i.len) + "]";
+	}
+
+	return out;
+}
+
+std::vector<TypeRec> save_types()
+{
+	std::vector<TypeRec> out;
+
+	for (Type t = P_COUNT; t < types.size(); ++t)
+	{
+		const TypeInfo &i = types[t];
+		out.push_back({ i.kind, i.base, i.quals, 0, i.of, i.len });
+	}
+
+	return out;
+}
+
+bool load_types(const TypeRec *recs, std::uint32_t count, std::vector<Type> &map)
+{
+	map.clear();
+	for (Type t = 0; t < P_COUNT; ++t)
+		map.push_back(t);
+
+	for (std::uint32_t i = 0; i < count; ++i)
+	{
+		const TypeRec &r = recs[i];
+
+		// a type only refers to earlier ones
+		if (r.kind > T_ARRAY || r.base >= P_COUNT || r.of >= map.size()
+			|| (r.kind != T_BASE && types[map[r.of]].base != r.base)
+			|| (r.kind == T_ARRAY && !array_fits(map[r.of], r.len)))
+			return false;
+
+		map.push_back(make_type(static_cast<TypeKind>(r.kind), static_cast<PrimType>(r.base),
+			r.quals, map[r.of], r.len));
+	}
 
 	return true;
 }
 
-bool compat_types(PrimType out, AST **in)
+// -------- compatibility -------- //
+
+void compat_types(AST parent)
+{
+	Type l = parent.lhs().ptype();
+	Type r = parent.rhs().ptype();
+	
+	if (types[l].unqual == types[r].unqual)
+		return;
+
+	// lvalue will be widened
+	if (p_sizeof(l) < p_sizeof(r))
+		parent.lhs() = AST::make(WIDEN, parent.rhs().ptype(), parent.lhs());
+	// rvalue will be widened
+	else
+		parent.rhs() = AST::make(WIDEN, parent.lhs().ptype(), parent.rhs());
+}
+
+AST compat_types(Type out, AST in)
 {
-	PrimType i = (*in)->ptype;
+	Type i = in.ptype();
 
 	if (out == VOID || i == VOID)
 		err("Expression attempted to use void type");
 	
-	if (out == i)
-		return true;
-	
+	if (types[out].plain == types[i].plain)
+		return in;
+
+	bool out_ptr = types[out].kind == T_PTR, in_ptr = types[i].kind == T_PTR;
+	if (out_ptr && in_ptr)
+		err("Incompatible pointer types " + type_name(i) + " and " + type_name(out));
+	if (out_ptr != in_ptr)
+		warning("Conversion between " + type_name(i) + " and " + type_name(out) + " without a cast");
+
 	if (p_sizeof(out) < p_sizeof(i))
+	{
 		// value will be truncated
 		warning("value will be truncated. where? idk you wrote it");
-	// rvalue will be widened
-	else
-		*in = new AST(WIDEN, out, *in);
+		return AST::make(TRUNC, out, in);
+	}
 
-	return true;
+	// rvalue will be widened
+	return AST::make(WIDEN, out, in);
 }
 
-Size p_sizeof(PrimType t)
+Size p_sizeof(Type t)
 {
-	switch (t) {
-		case CHAR:  return Byte;
-		case INT:   return Long;
-		case CHAR_PTR:
-		case LONG_PTR:
-		case INT_PTR:
-		case LONG: 	return Quad;
-		default:
-			err("Attempted to get size of invalid type");
-	}
+	const TypeInfo &i = types[t];
+
+	if (i.kind == T_BASE && !i.bytes)
+		err("Attempted to get size of invalid type");
+	// no array values yet, only their storage
+	if (i.kind == T_ARRAY)
+		err("Attempted to use array of type " + type_name(t) + " as a value");
 
-	// supress warning
-	return Byte;
+	return i.size;
 }
 
-PrimType pointer_type(PrimType t)
+Size reg_size(Type t)
 {
-	switch (t) {
-		case VOID: return VOID_PTR;
-		case INT:  return INT_PTR;
-		case CHAR: return CHAR_PTR;
-		case LONG: return LONG_PTR;
-		default:
-			err("Invalid pointer_to type");
-	}
-
-	// supress warning
-	return VOID;
+	Size s = p_sizeof(t);
+	return s < Long ? Long : s;
 }
@@ -1,5 +1,9 @@
 #include <codegen.hpp>
 
+#include <algorithm>
+#include <queue>
+
+#include <ir.hpp>
 #include <types.hpp>
 #include <err.hpp>
 
@@ -12,293 +16,620 @@ enum Reg : int8_t {
 const int ARG_COUNT = 6;
 
 static const char *REGS[4][13] = {
-	{ "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b", "%dil", "%sil", "%dl",  "%cl",  "%r8l", "%r9l", "%al"  }, // 8
+	{ "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b", "%dil", "%sil", "%dl",  "%cl",  "%r8b", "%r9b", "%al"  }, // 8
 	{ "%r10w", "%r11w", "%r12w", "%r13w", "%r14w", "%r15w", "%di",  "%si",  "%dx",  "%cx",  "%r8w", "%r9w", "%ax"  }, // 16
 	{ "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d", "%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d", "%eax" }, // 32
 	{ "%r10",  "%r11",  "%r12",  "%r13",  "%r14",  "%r15",  "%rdi", "%rsi", "%rdx", "%rcx", "%r8",  "%r9",  "%rax" }, // 64
 };
 
 static const char *MOV[4] = { "movb ", "movw ", "movl ", "movq " };
+static const char *SUFFIX[4] = { "b", "w", "l", "q" };
 static const char *GLOBL_ALLOC[4] = { ".byte ", ".word ", ".long ", ".quad " };
-static const char *CMP_SET[6] = { "setle ", "setge ", "sete ", "setne ", "setl ", "setg " };
-static const char *JMPS[7] = { "jg ", "jl ", "jne ", "je ", "jge ", "jle ", "jmp " };
+static const char *SETCC[6] = { "setle ", "setge ", "sete ", "setne ", "setl ", "setg " };
+static const char *JMPS[7] = { "jle ", "jge ", "je ", "jne ", "jl ", "jg ", "jmp " };
+static const Idx INVERT[6] = { GT, LT, NE, EQ, GE, LE };
+// IR_ADD to IR_SHR, division has its own sequence
+static const char *BINOPS[10] = { "add ", "sub ", "imul ", nullptr, nullptr, "and ", "or ", "xor ", "sal ", "sar " };
+
+// r10 and r11 are clobbered by calls, r12 to r15 by nobody but us
+const Reg FIRST_SAVED = R2;
 
 std::ofstream out;
 
-void emit_jmp(int type, int lbl)
-{
-	out << '\t' << JMPS[type] << 'L' << lbl << '\n';
-}
+// -------- register allocation -------- //
 
-void emit_lbl(int lbl)
-{
-	out << 'L' << lbl << ":\n";
-}
+// function being selected
+static const IRFunc *fn;
+// register of each virtual register
+static std::vector<Reg> where;
+// registers to save around each call, one bit per register
+static std::vector<unsigned> call_saves;
+// callee saved registers the function uses
+static unsigned used;
 
-Reg emit_mov(Reg src, Reg dst, Size s)
+// a move between a register and the frame before the instruction at pos.
+// a load gives v the register from there on, with off 0 it only does that
+struct Spill
 {
-	if (src == dst)
-		return src;
+	int pos;
+	Reg r;
+	int off;
+	VReg v;
+	// stores after a definition go first, the register may be loaded
+	// into again at the same pos
+	bool def;
+};
+
+// frame offset of each spilled virtual register, 0 if it isn't
+static std::vector<int> slot;
+static std::vector<Spill> spills;
+// bytes of spill slots below the locals
+static int spill_bytes;
 
-	out << '\t' << MOV[s] << REGS[s][src] << ", " << REGS[s][dst] << '\n';
-	if (src < FIRST_ARG) free_reg(src);
-	return dst;
+static bool hints(IROp op)
+{
+	return op <= IR_WIDEN || (op >= IR_ADD && op <= IR_NOT);
 }
 
-void emit_mov(Reg src, int offset, Size s)
+// linear scan over the intervals, a virtual register that is read for
+// the last time by the instruction defining another one hands its
+// register over, which saves a mov in two address code. when all are
+// taken, the one read furthest away is moved out to the frame. it is
+// stored after each of its definitions so it is there on every path, and
+// loaded into a register for just the instructions reading it. a call
+// takes its args from the frame as well as from registers
+static void alloc_regs()
 {
-	out << '\t' << MOV[s] << REGS[s][src] << ", ";
+	std::vector<int> last(fn->vregs, -1);
+	for (const Interval &iv : fn->intervals())
+		last[iv.v] = iv.end;
+
+	where.assign(fn->vregs, NOREG);
+	slot.assign(fn->vregs, 0);
+	call_saves.clear();
+	spills.clear();
+	spill_bytes = 0;
+	used = 0;
+
+	// register each is in at pos, where only gets the first one
+	std::vector<Reg> cur(fn->vregs, NOREG);
+	// positions each is defined at, chained back from the latest
+	std::vector<int> last_def(fn->vregs, -1);
+	std::vector<std::pair<int, int>> defs;
+
+	bool busy[FIRST_ARG] = {};
+	// temps are the loads for the last instruction
+	std::vector<VReg> active, temps;
+	// by when they are last read, soonest on top
+	std::priority_queue<std::pair<int, VReg>> spilled;
+	// free slots and the pos they were last read at
+	std::vector<std::pair<int, int>> free_slots;
+	const Inst *inst = nullptr;
+	int pos = 0;
+
+	auto release = [&](std::size_t k) {
+		busy[cur[active[k]]] = false;
+		active[k] = active.back();
+		active.pop_back();
+	};
+
+	// frees the registers of everything last read before pos
+	auto expire = [&](int pos) {
+		for (std::size_t k = 0; k < active.size();)
+		{
+			if (last[active[k]] < pos)
+				release(k);
+			else
+				++k;
+		}
+	};
+
+	// a free register, something else is spilled if there is none
+	auto take = [&]() {
+		Reg r = NOREG;
+
+		for (int k = 0; k < FIRST_ARG && r == NOREG; ++k)
+			if (!busy[k])
+				r = static_cast<Reg>(k);
+
+		if (r == NOREG)
+		{
+			// read furthest away, but not by this instruction
+			std::size_t victim = active.size();
+			for (std::size_t k = 0; k < active.size(); ++k)
+				if (active[k] != inst->a && active[k] != inst->b
+					&& (victim == active.size() || last[active[k]] > last[active[victim]]))
+					victim = k;
+
+			VReg v = active[victim];
+			r = cur[v];
+
+			int first = pos;
+			for (int d = last_def[v]; d >= 0; d = defs[d].second)
+				first = defs[d].first;
+
+			// a slot is only reused if it's free from the first store on
+			for (std::size_t k = free_slots.size(); k-- > 0 && !slot[v];)
+			{
+				if (free_slots[k].second < first)
+				{
+					slot[v] = free_slots[k].first;
+					free_slots.erase(free_slots.begin() + k);
+				}
+			}
+
+			if (!slot[v])
+			{
+				spill_bytes += 8;
+				slot[v] = -(fn->frame + spill_bytes);
+			}
+
+			for (int d = last_def[v]; d >= 0; d = defs[d].second)
+				spills.push_back({ defs[d].first + 1, r, slot[v], NOVREG, true });
+
+			spilled.push({ -last[v], v });
+			cur[v] = NOREG;
+			active[victim] = active.back();
+			active.pop_back();
+		}
+
+		busy[r] = true;
+		if (r >= FIRST_SAVED)
+			used |= 1u << r;
+
+		return r;
+	};
+
+	for (int b : fn->order)
+	{
+		for (const Inst &i : fn->blocks[b].insts)
+		{
+			inst = &i;
+
+			for (VReg v : temps)
+			{
+				for (std::size_t k = 0; k < active.size(); ++k)
+				{
+					if (active[k] == v)
+					{
+						release(k);
+						cur[v] = NOREG;
+						break;
+					}
+				}
+			}
+			temps.clear();
+
+			// a register is free once the last instruction reading it is done
+			expire(pos);
+
+			for (; !spilled.empty() && -spilled.top().first < pos; spilled.pop())
+				free_slots.push_back({ slot[spilled.top().second], -spilled.top().first });
+
+			for (VReg v : { i.a, i.b })
+			{
+				if (v != NOVREG && slot[v] && cur[v] == NOREG)
+				{
+					cur[v] = take();
+					active.push_back(v);
+					temps.push_back(v);
+					spills.push_back({ pos, cur[v], slot[v], v, false });
+				}
+			}
+
+			if (i.op == IR_CALL)
+			{
+				unsigned mask = 0;
+				for (VReg v : active)
+					if (last[v] > pos && cur[v] < FIRST_SAVED)
+						mask |= 1u << cur[v];
+
+				call_saves.push_back(mask);
+
+				// the args are all moved out before the result comes back
+				expire(pos + 1);
+			}
+
+			if (i.dst != NOVREG)
+			{
+				// defined again after it was spilled, through a register
+				if (slot[i.dst])
+				{
+					cur[i.dst] = take();
+					active.push_back(i.dst);
+					temps.push_back(i.dst);
+					spills.push_back({ pos, cur[i.dst], 0, i.dst, false });
+					spills.push_back({ pos + 1, cur[i.dst], slot[i.dst], NOVREG, true });
+				}
+				else if (cur[i.dst] == NOREG)
+				{
+					if (hints(i.op) && i.a != NOVREG && last[i.a] == pos)
+					{
+						cur[i.dst] = cur[i.a];
+
+						for (VReg &v : active)
+							if (v == i.a)
+								v = i.dst;
+					}
+					else
+					{
+						cur[i.dst] = take();
+						active.push_back(i.dst);
+					}
+
+					where[i.dst] = cur[i.dst];
+				}
+
+				defs.push_back({ pos, last_def[i.dst] });
+				last_def[i.dst] = defs.size() - 1;
+			}
+
+			++pos;
+		}
+	}
 
-	if (offset) out << offset;
-	out << "(%rbp)\n";
+	std::stable_sort(spills.begin(), spills.end(), [](const Spill &x, const Spill &y) {
+		return x.pos < y.pos || (x.pos == y.pos && x.def && !y.def);
+	});
 }
 
-Reg emit_int(int val, Size s)
+// -------- selection -------- //
+
+static const char *reg(VReg v, Size s)
 {
-	Reg r = alloc_reg();
-	out << '\t' << MOV[s] << '$' << val << ", " << REGS[s][r] << '\n';
-	return r;
+	return REGS[s][where[v]];
 }
 
-void emit_push(Reg r)
+static void emit_push(Reg r)
 {
 	out << "\tpush " << REGS[Quad][r] << '\n';
 }
 
-void emit_pop(Reg r)
+static void emit_pop(Reg r)
 {
 	out << "\tpop " << REGS[Quad][r] << '\n';
 }
 
-// yes
-Reg emit_widen(Size oldtype, Size newtype, Reg r)
+static void emit_var(const Sym &s, Size sz)
 {
-	return r;
+	switch (s.vtype) {
+		case V_VAR:
+			if (s.val) out << s.val;
+			out << "(%rbp)";
+			break;
+
+		case V_GLOBL:
+			out << name_str(s.name) << "(%rip)";
+			break;
+
+		case V_REG:
+			out << REGS[sz][s.val];
+			break;
+	}
 }
 
-Reg emit_post(Reg val, NodeType op, const Sym &s)
+// two address code works on dst in place
+static void emit_copy(VReg src, VReg dst, Size s)
 {
-	if (op == POST_INC)
-		out << "\tinc " << REGS[Quad][val];
-	else if (op == POST_DEC)
-		out << "\tdec " << REGS[Quad][val];
-	out << '\n';
-
-	set_var(val, s);
-
-	// undo val
-	if (op == POST_INC)
-		out << "\tdec " << REGS[Quad][val];
-	else if (op == POST_DEC)
-		out << "\tinc " << REGS[Quad][val];
-	out << '\n';
-
-	return val;
+	if (where[src] != where[dst])
+		out << '\t' << MOV[s] << reg(src, s) << ", " << reg(dst, s) << '\n';
 }
 
-Reg emit_unop(Reg val, NodeType op)
+// b, or imm if there is none
+static void emit_src(const Inst &i)
 {
-	if (op == LOGNOT)
-	{
-		out << "\ttest " << REGS[Quad][val] << ", " << REGS[Quad][val] << '\n';
-		out << "\tmovq $0, " << REGS[Quad][val] << '\n';
-		out << "\tsetz " << REGS[Byte][val] << '\n';
-		return val;
-	}
+	if (i.b != NOVREG)
+		out << reg(i.b, i.size);
+	else
+		out << '$' << i.imm;
+}
 
-	switch (op) {
-		case NEG: out << "\tneg "; break;
-		case NOT: out << "\tnot "; break;
-		case UN_INC: out << "\tinc "; break;
-		case UN_DEC: out << "\tdec "; break;
+// sets the flags for a cc b
+static void emit_cmp(const Inst &i)
+{
+	if (i.b == NOVREG && i.imm == 0)
+		out << "\ttest " << reg(i.a, i.size) << ", " << reg(i.a, i.size) << '\n';
+	else
+	{
+		out << "\tcmp ";
+		emit_src(i);
+		out << ", " << reg(i.a, i.size) << '\n';
 	}
+}
 
-	out << REGS[Quad][val] << '\n';
-
-	return val;
+static void emit_jmp(Idx cc, int b)
+{
+	out << '\t' << JMPS[cc] << 'L' << fn->blocks[b].lbl << '\n';
 }
 
-// note that sub, shr, and shl must be called with inverted args
-Reg emit_binop(Reg src, Reg dst, NodeType op)
+static void emit_div(const Inst &i)
 {
-	if (op == SHR || op == SHL)
-		// arg 3 = cl
-		src = emit_mov(src, A3, Byte);
-
-	switch (op) {
-		case SET_ADD:
-		case ADD: out << "\tadd "; break;
-		case SET_SUB:
-		case SUB: out << "\tsub "; break;
-		case SET_MUL:
-		case MUL: out << "\timul "; break;
-		case SET_OR:
-		case OR: out << "\tor "; break;
-		case SET_AND:
-		case AND: out << "\tand "; break;
-		case SET_XOR:
-		case XOR: out << "\txor "; break;
-		case SET_SHR:
-		case SHR: out << "\tsar "; break;
-		case SET_SHL:
-		case SHL: out << "\tsal "; break;
-	}
+	Size s = i.size;
 
-	out << REGS[Quad][src] << ", " << REGS[Quad][dst] << '\n';
+	// rdx is clobbered, and may hold a param
+	if (fn->params > A2 - A0)
+		emit_push(A2);
 
-	free_reg(src);
+	// 32 bit idiv is a lot cheaper than 64 bit
+	out << '\t' << MOV[s] << reg(i.a, s) << ", " << REGS[s][RR] << '\n';
+	out << (s == Quad ? "\tcqo\n" : "\tcltd\n");
+	out << "\tidiv" << SUFFIX[s] << ' ' << reg(i.b, s) << '\n';
+	out << '\t' << MOV[s] << REGS[s][i.op == IR_DIV ? RR : A2] << ", " << reg(i.dst, s) << '\n';
 
-	return dst;
+	if (fn->params > A2 - A0)
+		emit_pop(A2);
 }
 
-Reg emit_div(Reg dst, Reg src, NodeType op)
+static void emit_shift(const Inst &i)
 {
-	out << "\tmovq " << REGS[Quad][dst] << ", %rax\n";
+	Size s = i.size;
 
-	out << "\tcqo\n\tidiv " << REGS[Quad][src] << '\n';
+	emit_copy(i.a, i.dst, s);
 
-	if (op == DIV || op == SET_DIV)
-		out << "\tmovq %rax, " << REGS[Quad][dst] << '\n';
-	else
-		out << "\tmovq %rdx, " << REGS[Quad][dst] << '\n';
+	if (i.b == NOVREG)
+	{
+		out << '\t' << BINOPS[i.op - IR_ADD] << '$' << i.imm << ", " << reg(i.dst, s) << '\n';
+		return;
+	}
 
-	free_reg(src);
+	// the count has to be in cl, rcx may hold a param
+	if (fn->params > A3 - A0)
+		emit_push(A3);
 
-	return dst;
+	out << "\tmovl " << reg(i.b, Long) << ", " << REGS[Long][A3] << '\n';
+	out << '\t' << BINOPS[i.op - IR_ADD] << REGS[Byte][A3] << ", " << reg(i.dst, s) << '\n';
+
+	if (fn->params > A3 - A0)
+		emit_pop(A3);
 }
 
-Reg cmp_set(Reg a, Reg b, NodeType op)
+// an arg is in its register or spill slot
+static void emit_arg(VReg v)
 {
-	out << "\tcmp " << REGS[Quad][b] << ", " << REGS[Quad][a] << '\n';
-	out << "\tmov $0, " << REGS[Quad][a] << '\n';
-	out << '\t' << CMP_SET[op - N_LE] << REGS[Byte][a] << '\n';
-
-	free_reg(b);
-
-	return a;
+	if (slot[v])
+		out << slot[v] << "(%rbp)";
+	else
+		out << reg(v, Quad);
 }
 
-void cmp_jmp(Reg a, Reg b, NodeType op, int label)
+static void emit_call(const Inst &i, unsigned saves)
 {
-	out << "\tcmp " << REGS[Quad][b] << ", " << REGS[Quad][a] << '\n';
+	for (int r = 0; r < FIRST_SAVED; ++r)
+		if (saves & (1u << r))
+			emit_push(static_cast<Reg>(r));
 
-	emit_jmp(op - N_LE, label);
+	// the function's own params are in the arg registers
+	for (int k = 0; k < fn->params; ++k)
+		emit_push(static_cast<Reg>(A0 + k));
 
-	free_all();
-}
+	// the rest go on the stack, first arg on top
+	for (int k = i.f; k-- > ARG_COUNT;)
+	{
+		out << "\tpushq ";
+		emit_arg(fn->args[i.t + k]);
+		out << '\n';
+	}
 
-Reg logic_and_set(Reg a, AST *b, Ctx c)
-{
-	int second = label();
-	int end = label();
+	for (int k = 0; k < std::min(i.f, ARG_COUNT); ++k)
+	{
+		out << "\tmovq ";
+		emit_arg(fn->args[i.t + k]);
+		out << ", " << REGS[Quad][A0 + k] << '\n';
+	}
+
+	out << "\tcall " << name_str(i.sym->name) << '\n';
 
-	out << "\ttest " << REGS[Quad][a] << ", " << REGS[Quad][a] << '\n';
-	emit_jmp(EQ, second);
-	out << "\txor " << REGS[Quad][a] << ", " << REGS[Quad][a] << '\n';
-	emit_jmp(UNCOND, end);
+	if (i.f > ARG_COUNT)
+		out << "\tadd $" << 8 * (i.f - ARG_COUNT) << ", %rsp\n";
 
-	emit_lbl(second);
-	Reg rhs = gen_ast(b->rhs, Ctx(c, b->type));
-	out << "\ttest " << REGS[Quad][rhs] << ", " << REGS[Quad][rhs] << '\n';
-	out << "\tmov $0, " << REGS[Quad][a] << '\n';
-	out << '\t' << CMP_SET[NE] << REGS[Byte][a] << '\n';
+	out << "\tmovq " << REGS[Quad][RR] << ", " << reg(i.dst, Quad) << '\n';
 
-	emit_lbl(end);
+	for (int k = fn->params; k-- > 0;)
+		emit_pop(static_cast<Reg>(A0 + k));
 
-	free_reg(rhs);
-	return a;
+	for (int r = FIRST_SAVED; r-- > 0;)
+		if (saves & (1u << r))
+			emit_pop(static_cast<Reg>(r));
 }
 
-Reg logic_or_set(Reg a, AST *b, Ctx c)
+static void emit_ret(const Inst &i)
 {
-	int second = label();
-	int end = label();
-
-	out << "\ttest " << REGS[Quad][a] << ", " << REGS[Quad][a] << '\n';
-	emit_jmp(NE, second);
-	out << "\tmovq $1, " << REGS[Quad][a] << '\n';
-	emit_jmp(UNCOND, end);
+	Size s = i.size;
 
-	emit_lbl(second);
-	Reg rhs = gen_ast(b->rhs, Ctx(c, b->type));
-	out << "\ttest " << REGS[Quad][rhs] << ", " << REGS[Quad][rhs] << '\n';
-	out << "\tmov $0, " << REGS[Quad][a] << '\n';
-	out << '\t' << CMP_SET[NE] << REGS[Byte][a] << '\n';
+	if (i.a != NOVREG)
+		out << '\t' << MOV[s] << reg(i.a, s) << ", " << REGS[s][RR] << '\n';
+	else if (i.imm == 0)
+		out << "\txor %eax, %eax\n";
+	else
+		out << "\tmovl $" << i.imm << ", %eax\n";
 
-	emit_lbl(end);
+	for (int r = FIRST_ARG; r-- > FIRST_SAVED;)
+		if (used & (1u << r))
+			emit_pop(static_cast<Reg>(r));
 
-	free_reg(rhs);
-	return a;
+	out << "\tmov %rbp, %rsp\n\tpop %rbp\n\tret\n";
 }
 
-void cond_jmp(AST *n, Ctx c)
+// next is the block laid out after this one, it is fallen into
+static void emit_inst(const Inst &i, int next, std::size_t &call)
 {
-	// get node's value
-	Reg r = gen_ast(n, c);
+	Size s = i.size;
 
-	// really not sure what this does - are these supposed to be &&?
-	if (n->type < SHR || n->type > XOR || n->type < N_LE || n->type > N_GT)
-	{
-		out << "\ttest " << REGS[Quad][r] << ", " << REGS[Quad][r] << '\n';
-		out << '\t' << JMPS[NE] << 'L' << c.lbl << '\n';
-	}
-}
+	switch (i.op) {
+		case IR_IMM:
+			out << '\t' << MOV[s] << '$' << i.imm << ", " << reg(i.dst, s) << '\n';
+			break;
 
-void emit_call(const std::string &name)
-{
-	out << "\tcall " << name << '\n';
-}
+		case IR_MOV:
+			emit_copy(i.a, i.dst, s);
+			break;
 
-Reg load_var(const Sym &s)
-{
-	Reg r = alloc_reg();
+		// sign extends, there are no unsigned types
+		case IR_WIDEN:
+			out << "\tmovs" << SUFFIX[i.from] << SUFFIX[s] << ' '
+				<< reg(i.a, i.from) << ", " << reg(i.dst, s) << '\n';
+			break;
 
-	Size sz = p_sizeof(s.type);
+		// narrow values are sign extended as they are loaded
+		case IR_LOAD: {
+			Size sz = p_sizeof(i.sym->type);
 
-	out << '\t' << MOV[sz];
+			if (sz < s)
+				out << "\tmovs" << SUFFIX[sz] << SUFFIX[s] << ' ';
+			else
+				out << '\t' << MOV[sz];
 
-	switch (s.vtype) {
-		case V_VAR:
-			if (s.val) out << s.val;
-			out << "(%rbp), ";
+			emit_var(*i.sym, sz);
+			out << ", " << reg(i.dst, s) << '\n';
+			break;
+		}
+
+		case IR_STORE: {
+			Size sz = p_sizeof(i.sym->type);
+
+			out << '\t' << MOV[sz];
+			if (i.a != NOVREG)
+				out << reg(i.a, sz) << ", ";
+			else
+				out << '$' << i.imm << ", ";
+			emit_var(*i.sym, sz);
+			out << '\n';
 			break;
+		}
 
-		case V_GLOBL:
-			out << s.name << "(%rip), ";
+		case IR_DIV:
+		case IR_MOD:
+			emit_div(i);
 			break;
-		
-		case V_REG:
-			out << REGS[sz][s.val] << ", ";
+
+		case IR_SHL:
+		case IR_SHR:
+			emit_shift(i);
 			break;
-	}
 
-	out << REGS[sz][r] << '\n';
-	return r;
-}
+		case IR_ADD:
+		case IR_SUB:
+		case IR_MUL:
+		case IR_AND:
+		case IR_OR:
+		case IR_XOR:
+			emit_copy(i.a, i.dst, s);
+			out << '\t' << BINOPS[i.op - IR_ADD];
+			emit_src(i);
+			out << ", " << reg(i.dst, s) << '\n';
+			break;
 
-Reg set_var(Reg r, const Sym &s)
-{
-	Size sz = p_sizeof(s.type);
+		// setcc only writes the low byte
+		case IR_SETCC:
+			emit_cmp(i);
+			out << '\t' << SETCC[i.cc] << reg(i.dst, Byte) << '\n';
+			out << "\tmovzbl " << reg(i.dst, Byte) << ", " << reg(i.dst, Long) << '\n';
+			break;
 
-	out << '\t' << MOV[sz] << REGS[sz][r] << ", ";
+		case IR_NEG:
+		case IR_NOT:
+			emit_copy(i.a, i.dst, s);
+			out << (i.op == IR_NEG ? "\tneg " : "\tnot ") << reg(i.dst, s) << '\n';
+			break;
 
-	switch (s.vtype) {
-		case V_VAR:
-			if (s.val) out << s.val;
-			out << "(%rbp)";
+		case IR_CALL:
+			emit_call(i, call_saves[call++]);
 			break;
 
-		case V_GLOBL:
-			out << s.name << "(%rip)";
+		case IR_JMP:
+			if (i.t != next)
+				emit_jmp(UNCOND, i.t);
 			break;
 
-		case V_REG:
-			out << REGS[sz][s.val];
+		// only jump where the next block isn't
+		case IR_BR:
+			emit_cmp(i);
+
+			if (i.f == next)
+				emit_jmp(i.cc, i.t);
+			else if (i.t == next)
+				emit_jmp(INVERT[i.cc], i.f);
+			else
+			{
+				emit_jmp(i.cc, i.t);
+				emit_jmp(UNCOND, i.f);
+			}
+			break;
+
+		case IR_RET:
+			emit_ret(i);
 			break;
 	}
+}
+
+void select_func(const IRFunc &f)
+{
+	fn = &f;
+	alloc_regs();
+
+	out << ".globl " << name_str(f.sym->name) << '\n';
+	out << name_str(f.sym->name) << ":\n";
+	out << "\tpush %rbp\n\tmov %rsp, %rbp\n";
+
+	if (f.frame + spill_bytes)
+		out << "\tsub $" << f.frame + spill_bytes << ", %rsp\n";
+
+	for (int r = FIRST_SAVED; r < FIRST_ARG; ++r)
+		if (used & (1u << r))
+			emit_push(static_cast<Reg>(r));
+
+	// blocks a jump goes to, the rest are only fallen into
+	std::vector<bool> jumped(f.blocks.size());
+
+	for (std::size_t k = 0; k < f.order.size(); ++k)
+	{
+		const Inst &i = f.blocks[f.order[k]].insts.back();
+		int next = k + 1 < f.order.size() ? f.order[k + 1] : -1;
+
+		if (i.op == IR_JMP && i.t != next)
+			jumped[i.t] = true;
+		else if (i.op == IR_BR)
+		{
+			if (i.f == next)
+				jumped[i.t] = true;
+			else if (i.t == next)
+				jumped[i.f] = true;
+			else
+				jumped[i.t] = jumped[i.f] = true;
+		}
+	}
 
-	out << '\n';
-	return r;
+	std::size_t call = 0, spill = 0;
+	int pos = 0;
+
+	for (std::size_t k = 0; k < f.order.size(); ++k)
+	{
+		const Block &b = f.blocks[f.order[k]];
+		int next = k + 1 < f.order.size() ? f.order[k + 1] : -1;
+
+		if (jumped[f.order[k]])
+			out << 'L' << b.lbl << ":\n";
+
+		for (const Inst &i : b.insts)
+		{
+			for (; spill < spills.size() && spills[spill].pos == pos; ++spill)
+			{
+				const Spill &s = spills[spill];
+
+				if (s.v == NOVREG)
+					out << "\tmovq " << REGS[Quad][s.r] << ", " << s.off << "(%rbp)\n";
+				else
+				{
+					where[s.v] = s.r;
+					if (s.off)
+						out << "\tmovq " << s.off << "(%rbp), " << REGS[Quad][s.r] << '\n';
+				}
+			}
+
+			emit_inst(i, next, call);
+			++pos;
+		}
+	}
 }
 
 void gen_globls()
@@ -313,54 +644,16 @@ void gen_globls()
 
 		// uninitialized
 		if (!p.second)
-			out << ".comm " << p.first.name << ", " << (1 << p_sizeof(p.first.type)) << '\n';
+			out << ".comm " << name_str(p.first.name) << ", " << type_info(p.first.type).bytes << '\n';
 		else
-			out << p.first.name << ": " << GLOBL_ALLOC[p_sizeof(p.first.type)] << ' ' << p.second->val << '\n';
+			out << name_str(p.first.name) << ": " << GLOBL_ALLOC[p_sizeof(p.first.type)] << ' ' << p.second.val() << '\n';
 	}
 }
 
-void stack_alloc(int offset)
-{
-	if (offset < 0)
-		out << "\tsub $" << (-offset) << ", %rsp\n";
-	else if (offset > 0)
-		out << "\tadd $" << offset << ", %rsp\n";
-}
-
-void stack_dealloc(int size)
-{
-	if (size)
-		out << "\tadd $" << size << ", %rsp\n";
-}
-
-void emit_func_hdr(const Sym &s, int offset)
-{
-	out << ".globl " << s.name << '\n';
-	out << s.name << ":\n";
-	out << "\tpush %rbp\n\tmov %rsp, %rbp\n";
-
-	stack_alloc(offset);
-}
-
-void emit_epilogue()
-{
-	out << "\txor %rax, %rax\n\tmov %rbp, %rsp\n\tpop %rbp\n\tret\n";
-}
-
-void emit_ret(Reg r, Size s)
-{
-	// lets the register be rax or be empty return (in void function)
-	if (r != RR && r != NOREG)
-		out << '\t' << MOV[s] << REGS[s][r] << ", " << REGS[s][RR] << '\n';
-	out << "\tmov %rbp, %rsp\n\tpop %rbp\n\tret\n";
-}
-
 void init_cg(const std::string &filename)
 {
 	out.open(filename);
 
 	if (!out)
 		err("Output file failed to open");
-	
-	free_all();
 }
@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+
+# benchmark for deeply nested code. every case nests one construct n deep
+# (1M by default), compiles it on a small stack and checks what the
+# program returns. parsing and codegen keep their own stacks, so the
+# native stack size shouldn't matter
+#
+# usage: tests/deep.sh [n] [stack kb]
+
+n=${1:-1000000}
+stack=${2:-2048}
+
+cc_path="$(cd "$( dirname "${BASH_SOURCE[0]}" )/.." &> /dev/null && pwd)"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# s repeated count times
+rep() {
+	yes -- "$1" | head -n "$2" | tr -d '\n'
+}
+
+fail=0
+
+# name, expected exit code, then the source on stdin
+run() {
+	local name=$1 want=$2
+	local src=$dir/$name.c
+
+	cat > "$src"
+
+	local start=$(date +%s%N)
+	(cd "$dir" && ulimit -s "$stack" && "$cc_path/cc.out" -q "$src" > /dev/null)
+	local code=$?
+	local ms=$(( ($(date +%s%N) - start) / 1000000 ))
+
+	if [[ $code -ne 0 ]]; then
+		printf '%-12s compile failed (%d)\n' "$name" "$code"
+		fail=1
+		return
+	fi
+
+	# right nested operands all wait in spill slots
+	gcc "$dir/out.s" -o "$dir/a.out" 2> /dev/null && (ulimit -s hard && "$dir/a.out")
+	local got=$?
+
+	if [[ $got -ne $want ]]; then
+		printf '%-12s expected %d, got %d\n' "$name" "$want" "$got"
+		fail=1
+	else
+		printf '%-12s %4d.%03ds\n' "$name" $(( ms / 1000 )) $(( ms % 1000 ))
+	fi
+}
+
+main() {
+	echo "int main() { int a = 1; int z = 0; $1 }"
+}
+
+echo "n = $n, stack = ${stack}k"
+
+main "return $(rep 'a + ' $n)a;" | run binary $(( (n + 1) % 256 ))
+main "return $(rep '(' $n)a$(rep ')' $n);" | run parens 1
+main "return $(rep 'a - (' $n)a$(rep ')' $n);" | run right $(( (n + 1) % 2 ))
+main "return $(rep '- ' $n)a;" | run negate $(( n % 2 ? 255 : 1 ))
+main "return $(rep 'a == 0 ? 0 : ' $n)a;" | run cond_else 1
+main "return $(rep '(' $n)a$(rep ' ? 1 : 0)' $n);" | run cond_cond 1
+main "return $(rep 'a ? ' $n)a$(rep ' : 0' $n);" | run cond_then 1
+{ echo "int f(int x) { return x + 1; }"; main "return $(rep 'f(' $n)a$(rep ')' $n);"; } | run calls $(( (n + 1) % 256 ))
+{ echo "int f(int x, int y) { return x + y; }"; main "return $(rep 'f(a, ' $n)a$(rep ')' $n);"; } | run call_args $(( (n + 1) % 256 ))
+main "$(rep 'if (a == 0) return 0; else ' $n)return a;" | run else_if 1
+main "$(rep 'if (a) ' $n)a = 2; return a;" | run if 2
+main "$(rep '{ ' $n)a = 2;$(rep ' }' $n) return a;" | run block 2
+main "$(rep 'while (z) ' $n)z = 1; return a;" | run while 1
+main "$(rep 'for (; z;) ' $n)z = 1; return a;" | run for 1
+main "$(rep 'do ' $n);$(rep ' while (z);' $n) return a;" | run do 1
+
+exit $fail
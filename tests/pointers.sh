@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+
+# pointer arithmetic and compatibility. run cases compile a program and
+# check what it returns, reject cases have to fail to compile. there is
+# no & or * yet, so pointers start from integers
+#
+# usage: tests/pointers.sh
+
+cc_path="$(cd "$( dirname "${BASH_SOURCE[0]}" )/.." &> /dev/null && pwd)"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail=0
+
+# name, expected exit code, then the body of main on stdin
+run() {
+	local name=$1 want=$2
+
+	{ echo "int main() {"; cat; echo "}"; } > "$dir/$name.c"
+
+	if ! (cd "$dir" && "$cc_path/cc.out" -q "$name.c" > /dev/null 2>&1); then
+		printf '%-12s compile failed\n' "$name"
+		fail=1
+		return
+	fi
+
+	gcc "$dir/out.s" -o "$dir/a.out" 2> /dev/null && "$dir/a.out"
+	local got=$?
+
+	if [[ $got -ne $want ]]; then
+		printf '%-12s expected %d, got %d\n' "$name" "$want" "$got"
+		fail=1
+	else
+		printf '%-12s ok\n' "$name"
+	fi
+}
+
+# name, then the body of main on stdin
+reject() {
+	local name=$1
+
+	{ echo "int main() {"; cat; echo "}"; } > "$dir/$name.c"
+
+	if (cd "$dir" && "$cc_path/cc.out" -q "$name.c" > /dev/null 2>&1); then
+		printf '%-12s compiled, should be rejected\n' "$name"
+		fail=1
+	else
+		printf '%-12s ok\n' "$name"
+	fi
+}
+
+# + and - step by elements
+run add_int 12 <<< 'int *p = 0; p = p + 3; long v = p; return v;'
+run add_char 5 <<< 'char *c = 0; c = 5 + c; long v = c; return v;'
+run add_var 20 <<< 'int *p = 0; int i = 2; p = p + i * 3; p -= 1; long v = p; return v;'
+run step_long 24 <<< 'long *p = 0; p++; p += 2; long v = p; return v;'
+run sub_ptr 8 <<< 'int **pp = 0; pp = pp - 1; long v = pp; return -v;'
+run dec_ptr 4 <<< 'int *p = 0; --p; p--; long v = p; return v + 12;'
+
+# the difference of two pointers is in elements
+run diff 7 <<< 'int *p = 0; int *q = p + 7; long d = q - p; return d;'
+run diff_char 9 <<< 'char *p = 0; char *q = p + 9; return q - p;'
+
+# qualifiers don't change the pointee
+run qualified 4 <<< 'const int *c = 0; int *p = c + 1; long v = p; return v;'
+run compare 2 <<< 'int *p = 0; int *q = p + 1; return (q > p) + (p == 0);'
+
+# pointers to different types don't mix
+reject assign <<< 'char *c = 0; int *p = c; return 0;'
+reject compare_mix <<< 'int *p = 0; long *q = 0; return p == q;'
+reject diff_mix <<< 'int *p = 0; long *q = 0; return q - p;'
+reject mul <<< 'int *p = 0; return p * 2;'
+reject add_ptrs <<< 'int *p = 0; int *q = p + p; return 0;'
+reject set_mul <<< 'int *p = 0; p *= 2; return 0;'
+
+exit $fail